@@ -0,0 +1,146 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <limits>
+
+// Like PDFNumeric, but instead of 100 evenly spaced CDF bins, the knots of the piecewise linear CDF are placed
+// where they are needed so that the ICDF is within a given tolerance (in x) of the ICDF of a finely sampled CDF.
+// Peaked PDFs get knots packed around the peaks, and flat parts of the PDF get very few knots.
+// Only the knots are kept, and the PDF comes from the slope of the CDF, so the memory used is 8 bytes per knot.
+struct PDFNumericAdaptive
+{
+    static const int c_PDFSamples = 10000;
+
+    typedef std::function<float(float)> PDFFn;
+
+    PDFNumericAdaptive(const PDFFn& pdf, float tolerance = 1e-3f, float xmin = 0.0f, float xmax = 1.0f)
+    {
+        // Make a finely sampled CDF by integrating the PDF with the trapezoid rule
+        std::vector<float> fineX(c_PDFSamples);
+        std::vector<double> fineCDF(c_PDFSamples);
+        float lastPDF = 0.0f;
+        double total = 0.0;
+        for (int i = 0; i < c_PDFSamples; ++i)
+        {
+            fineX[i] = Lerp(xmin, xmax, float(i) / float(c_PDFSamples - 1));
+            float pdfValue = std::max(pdf(fineX[i]), 0.0f);
+            if (i > 0)
+                total += 0.5 * double(lastPDF + pdfValue) * double(fineX[i] - fineX[i - 1]);
+            fineCDF[i] = total;
+            lastPDF = pdfValue;
+        }
+        for (double& d : fineCDF)
+            d /= total;
+
+        // Greedily make each segment as long as possible. The line from knot a to a later point b is within tolerance
+        // of the point k in between if its slope (dx / dCDF) is in [(dx_k - tolerance) / dCDF_k, (dx_k + tolerance) / dCDF_k].
+        // The intersection of those ranges is kept as points are passed, which makes this O(n).
+        int knot = 0;
+        AddKnot(fineX[0], fineCDF[0]);
+        while (knot < c_PDFSamples - 1)
+        {
+            double minSlope = -std::numeric_limits<double>::max();
+            double maxSlope = std::numeric_limits<double>::max();
+            int lastGood = knot + 1;
+            for (int b = knot + 1; b < c_PDFSamples; ++b)
+            {
+                double dx = double(fineX[b]) - double(fineX[knot]);
+                double dCDF = fineCDF[b] - fineCDF[knot];
+
+                if (dCDF > 0.0)
+                {
+                    // Is the line to b within tolerance of all the points before b?
+                    double slope = dx / dCDF;
+                    if (slope < minSlope || slope > maxSlope)
+                        break;
+                    lastGood = b;
+
+                    // The line to any later point also needs to be within tolerance of b
+                    minSlope = std::max(minSlope, (dx - tolerance) / dCDF);
+                    maxSlope = std::min(maxSlope, (dx + tolerance) / dCDF);
+                }
+                else
+                {
+                    // There is no mass between the knot and b, so the ICDF never lands in here, and the segment
+                    // can be as wide as it likes. It can only continue on past mass though if it is narrower than the tolerance.
+                    lastGood = b;
+                    if (dx > tolerance)
+                        minSlope = std::numeric_limits<double>::max();
+                }
+            }
+
+            knot = lastGood;
+            AddKnot(fineX[knot], fineCDF[knot]);
+        }
+    }
+
+    float PDF(float x) const
+    {
+        if (x < m_x.front() || x > m_x.back())
+            return 0.0f;
+
+        int upperIndex = Clamp(int(std::upper_bound(m_x.begin(), m_x.end(), x) - m_x.begin()), 1, int(m_x.size()) - 1);
+        return (m_CDF[upperIndex] - m_CDF[upperIndex - 1]) / (m_x[upperIndex] - m_x[upperIndex - 1]);
+    }
+
+    float CDF(float x) const
+    {
+        if (x <= m_x.front())
+            return 0.0f;
+
+        if (x >= m_x.back())
+            return 1.0f;
+
+        int upperIndex = int(std::upper_bound(m_x.begin(), m_x.end(), x) - m_x.begin());
+        float fraction = (x - m_x[upperIndex - 1]) / (m_x[upperIndex] - m_x[upperIndex - 1]);
+        return Lerp(m_CDF[upperIndex - 1], m_CDF[upperIndex], fraction);
+    }
+
+    float ICDF(float x) const
+    {
+        if (x <= 0.0f)
+            return m_x.front();
+
+        if (x >= 1.0f)
+            return m_x.back();
+
+        int upperIndex = std::max(int(std::lower_bound(m_CDF.begin(), m_CDF.end(), x) - m_CDF.begin()), 1);
+        float fraction = (x - m_CDF[upperIndex - 1]) / (m_CDF[upperIndex] - m_CDF[upperIndex - 1]);
+        return Lerp(m_x[upperIndex - 1], m_x[upperIndex], fraction);
+    }
+
+    void PDF(const float* x, float* out, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = PDF(x[i]);
+    }
+
+    void CDF(const float* x, float* out, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = CDF(x[i]);
+    }
+
+    void ICDF(const float* x, float* out, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = ICDF(x[i]);
+    }
+
+    int NumKnots() const
+    {
+        return int(m_x.size());
+    }
+
+    std::vector<float> m_x;
+    std::vector<float> m_CDF;
+
+private:
+    void AddKnot(float x, double cdf)
+    {
+        m_x.push_back(x);
+        m_CDF.push_back(float(cdf));
+    }
+};
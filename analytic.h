@@ -1,5 +1,8 @@
 #pragma once
 
+#include "simd.h"
+#include "instrumentation.h"
+
 // y = 1
 struct PDFUniform
 {
@@ -8,6 +11,7 @@ struct PDFUniform
 
     float PDF(float x) const
     {
+        INSTRUMENT_COUNT(PDFCalls, 1);
         if (x < c_xmin || x > c_xmax)
             return 0.0f;
         return 1.0f;
@@ -15,6 +19,7 @@ struct PDFUniform
 
     float CDF(float x) const
     {
+        INSTRUMENT_COUNT(CDFCalls, 1);
         if (x < c_xmin)
             return 0.0f;
 
@@ -26,6 +31,7 @@ struct PDFUniform
 
     float ICDF(float x) const
     {
+        INSTRUMENT_COUNT(ICDFCalls, 1);
         if (x < c_xmin)
             return 0.0f;
 
@@ -34,6 +40,51 @@ struct PDFUniform
 
         return x;
     }
+
+    void PDF(const float* x, float* out, size_t count) const
+    {
+        size_t i = 0;
+#if SIMD_AVX2()
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 v = _mm256_loadu_ps(x + i);
+            _mm256_storeu_ps(out + i, _mm256_and_ps(SIMDInRange(v, c_xmin, c_xmax), _mm256_set1_ps(1.0f)));
+        }
+#endif
+        INSTRUMENT_COUNT(PDFCalls, i);
+        for (; i < count; ++i)
+            out[i] = PDF(x[i]);
+    }
+
+    void CDF(const float* x, float* out, size_t count) const
+    {
+        size_t i = 0;
+#if SIMD_AVX2()
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 v = SIMDClamp(_mm256_loadu_ps(x + i), c_xmin, c_xmax);
+            _mm256_storeu_ps(out + i, v);
+        }
+#endif
+        INSTRUMENT_COUNT(CDFCalls, i);
+        for (; i < count; ++i)
+            out[i] = CDF(x[i]);
+    }
+
+    void ICDF(const float* x, float* out, size_t count) const
+    {
+        size_t i = 0;
+#if SIMD_AVX2()
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 v = SIMDClamp(_mm256_loadu_ps(x + i), c_xmin, c_xmax);
+            _mm256_storeu_ps(out + i, v);
+        }
+#endif
+        INSTRUMENT_COUNT(ICDFCalls, i);
+        for (; i < count; ++i)
+            out[i] = ICDF(x[i]);
+    }
 };
 
 // y = 2x
@@ -44,6 +95,7 @@ struct PDFLinear
 
     float PDF(float x) const
     {
+        INSTRUMENT_COUNT(PDFCalls, 1);
         if (x < c_xmin || x > c_xmax)
             return 0.0f;
         return 2.0f * x;
@@ -51,6 +103,7 @@ struct PDFLinear
 
     float CDF(float x) const
     {
+        INSTRUMENT_COUNT(CDFCalls, 1);
         if (x < c_xmin)
             return 0.0f;
 
@@ -62,6 +115,7 @@ struct PDFLinear
 
     float ICDF(float x) const
     {
+        INSTRUMENT_COUNT(ICDFCalls, 1);
         if (x < c_xmin)
             return 0.0f;
 
@@ -70,6 +124,51 @@ struct PDFLinear
 
         return std::sqrt(x);
     }
+
+    void PDF(const float* x, float* out, size_t count) const
+    {
+        size_t i = 0;
+#if SIMD_AVX2()
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 v = _mm256_loadu_ps(x + i);
+            _mm256_storeu_ps(out + i, _mm256_and_ps(SIMDInRange(v, c_xmin, c_xmax), _mm256_mul_ps(_mm256_set1_ps(2.0f), v)));
+        }
+#endif
+        INSTRUMENT_COUNT(PDFCalls, i);
+        for (; i < count; ++i)
+            out[i] = PDF(x[i]);
+    }
+
+    void CDF(const float* x, float* out, size_t count) const
+    {
+        size_t i = 0;
+#if SIMD_AVX2()
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 v = SIMDClamp(_mm256_loadu_ps(x + i), c_xmin, c_xmax);
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(v, v));
+        }
+#endif
+        INSTRUMENT_COUNT(CDFCalls, i);
+        for (; i < count; ++i)
+            out[i] = CDF(x[i]);
+    }
+
+    void ICDF(const float* x, float* out, size_t count) const
+    {
+        size_t i = 0;
+#if SIMD_AVX2()
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 v = SIMDClamp(_mm256_loadu_ps(x + i), c_xmin, c_xmax);
+            _mm256_storeu_ps(out + i, _mm256_sqrt_ps(v));
+        }
+#endif
+        INSTRUMENT_COUNT(ICDFCalls, i);
+        for (; i < count; ++i)
+            out[i] = ICDF(x[i]);
+    }
 };
 
 // y = 3x^2
@@ -80,6 +179,7 @@ struct PDFQuadratic
 
     float PDF(float x) const
     {
+        INSTRUMENT_COUNT(PDFCalls, 1);
         if (x < c_xmin || x > c_xmax)
             return 0.0f;
         return 3.0f * x * x;
@@ -87,6 +187,7 @@ struct PDFQuadratic
 
     float CDF(float x) const
     {
+        INSTRUMENT_COUNT(CDFCalls, 1);
         if (x < c_xmin)
             return 0.0f;
 
@@ -98,12 +199,58 @@ struct PDFQuadratic
 
     float ICDF(float x) const
     {
+        INSTRUMENT_COUNT(ICDFCalls, 1);
         if (x < c_xmin)
             return 0.0f;
 
         if (x > c_xmax)
             return 1.0f;
 
-        return std::powf(x, 1.0f / 3.0f);
+        return std::pow(x, 1.0f / 3.0f);
+    }
+
+    void PDF(const float* x, float* out, size_t count) const
+    {
+        size_t i = 0;
+#if SIMD_AVX2()
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 v = _mm256_loadu_ps(x + i);
+            _mm256_storeu_ps(out + i, _mm256_and_ps(SIMDInRange(v, c_xmin, c_xmax), _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(3.0f), v), v)));
+        }
+#endif
+        INSTRUMENT_COUNT(PDFCalls, i);
+        for (; i < count; ++i)
+            out[i] = PDF(x[i]);
+    }
+
+    void CDF(const float* x, float* out, size_t count) const
+    {
+        size_t i = 0;
+#if SIMD_AVX2()
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 v = SIMDClamp(_mm256_loadu_ps(x + i), c_xmin, c_xmax);
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_mul_ps(v, v), v));
+        }
+#endif
+        INSTRUMENT_COUNT(CDFCalls, i);
+        for (; i < count; ++i)
+            out[i] = CDF(x[i]);
+    }
+
+    void ICDF(const float* x, float* out, size_t count) const
+    {
+        size_t i = 0;
+#if SIMD_AVX2()
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 v = SIMDClamp(_mm256_loadu_ps(x + i), c_xmin, c_xmax);
+            _mm256_storeu_ps(out + i, SIMDCbrt(v));
+        }
+#endif
+        INSTRUMENT_COUNT(ICDFCalls, i);
+        for (; i < count; ++i)
+            out[i] = ICDF(x[i]);
     }
 };
\ No newline at end of file
@@ -0,0 +1,187 @@
+// Benchmarks for Linux, which sweep distribution pairs, table resolutions, p values and sample counts over
+// PWassersteinDistance and InterpolatePDFs_*, and write one JSON object per line, so runs can be compared
+// between commits to catch regressions.
+//
+// Build and run:
+//   g++ -std=c++20 -O2 -mavx2 -pthread bench.cpp pcg/pcg_basic.c -o bench
+//   ./bench [output file, default bench.jsonl] [max samples, default 10000000]
+//
+// Add -D"INSTRUMENTATION()=true" to also record call counts, lower_bound probes, table build time and bytes allocated.
+// Instrumentation slows down the hot paths, so don't compare timings of instrumented and uninstrumented builds.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+// Every run uses the same random numbers, so the results can be compared too
+#define DETERMINISTIC() true
+#include "utils.h"
+#include "parallel.h"
+
+#include "analytic.h"
+#include "numeric.h"
+#include "sampling.h"
+#include "interpolate.h"
+
+static const int c_numRepeats = 3;
+static const int c_sampleCounts[] = { 100000, 1000000, 10000000 };
+static const float c_pValues[] = { 1.0f, 2.0f, 3.0f };
+
+struct BenchmarkSettings
+{
+    FILE* file = nullptr;
+    int maxSamples = 10000000;
+};
+
+struct BenchmarkCase
+{
+    const char* benchmark = "";
+    const char* pair = "";
+    const char* tables = "analytic";
+    int CDFSamples = 0;
+    float p = 0.0f;
+    int numSamples = 0;
+};
+
+// Runs fn c_numRepeats times, and writes the fastest time and the last result as a line of JSON.
+// The instrumentation counters are of the last run only.
+template <typename TFn>
+void RunBenchmark(const BenchmarkSettings& settings, const BenchmarkCase& benchmarkCase, const TFn& fn)
+{
+    double bestSeconds = 0.0;
+    float result = 0.0f;
+    for (int repeat = 0; repeat < c_numRepeats; ++repeat)
+    {
+#if INSTRUMENTATION()
+        Instrumentation::Get().Reset();
+#endif
+        auto start = std::chrono::steady_clock::now();
+        result = fn();
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+        bestSeconds = (repeat == 0) ? seconds.count() : std::min(bestSeconds, seconds.count());
+    }
+
+    fprintf(settings.file, "{\"benchmark\":\"%s\",\"pair\":\"%s\",\"tables\":\"%s\",\"CDFSamples\":%i,\"p\":%g,\"numSamples\":%i,\"threads\":%i,\"seconds\":%.9f,\"result\":%.9g",
+        benchmarkCase.benchmark, benchmarkCase.pair, benchmarkCase.tables, benchmarkCase.CDFSamples, benchmarkCase.p, benchmarkCase.numSamples,
+        GetNumThreads(), bestSeconds, result);
+
+    if (benchmarkCase.numSamples > 0)
+        fprintf(settings.file, ",\"nsPerSample\":%.4f", 1e9 * bestSeconds / double(benchmarkCase.numSamples));
+
+#if INSTRUMENTATION()
+    InstrumentationSnapshot snapshot = Instrumentation::Get().Snapshot();
+    for (int i = 0; i < int(InstrumentationCounter::Count); ++i)
+        fprintf(settings.file, ",\"%s\":%llu", InstrumentationCounterName(InstrumentationCounter(i)), (unsigned long long)snapshot.counters[i]);
+
+    fprintf(settings.file, ",\"bytesAllocated\":{");
+    bool first = true;
+    for (const auto& routine : snapshot.bytesAllocated)
+    {
+        fprintf(settings.file, "%s\"%s\":%llu", first ? "" : ",", routine.first.c_str(), (unsigned long long)routine.second);
+        first = false;
+    }
+    fprintf(settings.file, "}");
+#endif
+
+    fprintf(settings.file, "}\n");
+    fflush(settings.file);
+}
+
+template <typename PDF1, typename PDF2>
+void BenchmarkPair(const BenchmarkSettings& settings, BenchmarkCase benchmarkCase, const PDF1& pdf1, const PDF2& pdf2)
+{
+    benchmarkCase.benchmark = "PWassersteinDistance";
+    for (float p : c_pValues)
+    {
+        for (int numSamples : c_sampleCounts)
+        {
+            if (numSamples > settings.maxSamples)
+                continue;
+
+            benchmarkCase.p = p;
+            benchmarkCase.numSamples = numSamples;
+            RunBenchmark(settings, benchmarkCase, [&]() { return PWassersteinDistance(p, pdf1, pdf2, numSamples); });
+        }
+    }
+
+    // The interpolations write CSV files like main does. The writing is timed too, by waiting for the writer thread.
+    // The files are deleted afterwards, since only the time matters.
+    char fileName[256];
+    benchmarkCase.p = 0.0f;
+    benchmarkCase.numSamples = 0;
+
+    benchmarkCase.benchmark = "InterpolatePDFs_PDF";
+    sprintf_s(fileName, "_bench_%s_%s_%i_PDF.csv", benchmarkCase.pair, benchmarkCase.tables, benchmarkCase.CDFSamples);
+    RunBenchmark(settings, benchmarkCase, [&]() { InterpolatePDFs_PDF(fileName, pdf1, pdf2); OutputWriter::Get().Flush(); return 0.0f; });
+    remove(fileName);
+
+    benchmarkCase.benchmark = "InterpolatePDFs_ICDF";
+    sprintf_s(fileName, "_bench_%s_%s_%i_CDF.csv", benchmarkCase.pair, benchmarkCase.tables, benchmarkCase.CDFSamples);
+    RunBenchmark(settings, benchmarkCase, [&]() { InterpolatePDFs_ICDF(fileName, pdf1, pdf2); OutputWriter::Get().Flush(); return 0.0f; });
+    remove(fileName);
+}
+
+// All of the pairs, with tables of TCDFSamples entries
+template <int TCDFSamples>
+void BenchmarkTables(const BenchmarkSettings& settings)
+{
+    BenchmarkCase benchmarkCase;
+    benchmarkCase.tables = "table";
+    benchmarkCase.CDFSamples = TCDFSamples;
+
+    // Table builds are benchmarks too
+    auto uniform = MakePDFNumeric<10000, TCDFSamples>([](float) { return 1.0f; });
+    auto linear = MakePDFNumeric<10000, TCDFSamples>([](float x) { return 2.0f * x; });
+    auto quadratic = MakePDFNumeric<10000, TCDFSamples>([](float x) { return 3.0f * x * x; });
+    auto gauss1 = MakePDFNumeric<10000, TCDFSamples>([](float x) { x -= 0.2f; return std::exp(-x * x / (2.0f * 0.1f * 0.1f)); });
+    auto gauss2 = MakePDFNumeric<10000, TCDFSamples>([](float x) { x -= 0.6f; return std::exp(-x * x / (2.0f * 0.15f * 0.15f)); });
+
+    benchmarkCase.benchmark = "PDFNumericBuild";
+    benchmarkCase.pair = "Gauss1";
+    RunBenchmark(settings, benchmarkCase, [&]() { auto pdf = MakePDFNumeric<10000, TCDFSamples>(gauss1.m_PDF); return pdf.m_CDFTable[TCDFSamples / 2]; });
+
+    benchmarkCase.pair = "Uniform2Linear";
+    BenchmarkPair(settings, benchmarkCase, uniform, linear);
+    benchmarkCase.pair = "Uniform2Quadratic";
+    BenchmarkPair(settings, benchmarkCase, uniform, quadratic);
+    benchmarkCase.pair = "Linear2Quadratic";
+    BenchmarkPair(settings, benchmarkCase, linear, quadratic);
+    benchmarkCase.pair = "Gauss2Gauss";
+    BenchmarkPair(settings, benchmarkCase, gauss1, gauss2);
+}
+
+int main(int argc, char** argv)
+{
+    const char* fileName = (argc > 1) ? argv[1] : "bench.jsonl";
+
+    BenchmarkSettings settings;
+    if (argc > 2)
+        settings.maxSamples = atoi(argv[2]);
+
+    fopen_s(&settings.file, fileName, "wt");
+    if (!settings.file)
+    {
+        printf("Could not open %s for writing\n", fileName);
+        return 1;
+    }
+
+    BenchmarkCase benchmarkCase;
+    benchmarkCase.pair = "Uniform2Linear";
+    BenchmarkPair(settings, benchmarkCase, PDFUniform(), PDFLinear());
+    benchmarkCase.pair = "Uniform2Quadratic";
+    BenchmarkPair(settings, benchmarkCase, PDFUniform(), PDFQuadratic());
+    benchmarkCase.pair = "Linear2Quadratic";
+    BenchmarkPair(settings, benchmarkCase, PDFLinear(), PDFQuadratic());
+
+    BenchmarkTables<25>(settings);
+    BenchmarkTables<100>(settings);
+    BenchmarkTables<400>(settings);
+    BenchmarkTables<1000>(settings);
+
+    fclose(settings.file);
+    printf("Wrote %s\n", fileName);
+    return 0;
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include "simd.h"
+#include "numeric.h"
+
+// PDFNumeric CDF tables stored as 16 bit fixed point, packed one after another into an arena shared by many
+// distributions, so each one costs (c_CDFSamples + 1) * 2 bytes (rounded up to 32 bytes) and no heap allocation.
+//
+// Each CDF value is stored as round(CDF * 65535). Absolute values are stored rather than differences, so any entry
+// can be decoded on its own without a prefix sum, and the quantized values are still sorted, so they can be searched.
+// fp16 was not used since it only has 11 bits of precision near 1.
+//
+// Error bounds, compared to the float table:
+//   CDF: within 0.5 / 65535 = 1 / 131070.
+//   ICDF: for u in a bin with mass m, within (1 / 131070) / (m * c_CDFSamples) of the table's ICDF, which is
+//   the CDF error over the slope of the CDF there. Bins with less mass than 1 / 65535 can be lost entirely.
+//
+// The ICDF doesn't have a guide table, since that would be bigger than the CDF table. Instead the lower bound is
+// found by decoding 16 entries at a time with AVX2 and counting how many are less than u.
+template <int TCDFSamples = 100>
+struct PDFCompressedViewT
+{
+    static constexpr float c_xmin = 0.0f;
+    static constexpr float c_xmax = 1.0f;
+
+    static const int c_CDFSamples = TCDFSamples;
+
+    // Tables are padded with 65535 (1.0) to a multiple of 16 entries, for the AVX2 search.
+    // There is always at least one padding entry, since the AVX2 CDF gathers 32 bits at the address of a 16 bit
+    // entry, which also reads the entry after it, and the last entry of the last table in an arena is read that way.
+    static const int c_paddedSamples = (c_CDFSamples + 16) / 16 * 16;
+    static_assert(c_paddedSamples - c_CDFSamples >= int(sizeof(int32_t) / sizeof(uint16_t)) - 1, "The padding must cover the extra bytes of a gather");
+
+    static constexpr float c_scale = 65535.0f;
+
+    static float Decode(uint16_t value)
+    {
+        return float(value) * (1.0f / c_scale);
+    }
+
+    float PDF(float x) const
+    {
+        if (x < c_xmin || x > c_xmax)
+            return 0.0f;
+
+        int index = Clamp(int(x * float(c_CDFSamples)), 0, c_CDFSamples - 1);
+        float lowerValue = (index > 0) ? Decode(m_CDFTable[index - 1]) : 0.0f;
+        return (Decode(m_CDFTable[index]) - lowerValue) * float(c_CDFSamples);
+    }
+
+    float CDF(float x) const
+    {
+        if (x < c_xmin)
+            return 0.0f;
+
+        if (x > c_xmax)
+            return 1.0f;
+
+        float index = Clamp(x * float(c_CDFSamples), 0.0f, float(c_CDFSamples - 1));
+
+        int index1 = int(index);
+        int index2 = Clamp(index1 + 1, 0, c_CDFSamples - 1);
+        float fract = index - floor(index);
+        return Lerp(Decode(m_CDFTable[index1]), Decode(m_CDFTable[index2]), fract);
+    }
+
+    // Same as PDFNumeric::ICDF, on the decoded table
+    float ICDF(float x) const
+    {
+        if (x < c_xmin)
+            return 0.0f;
+
+        if (x > c_xmax)
+            return 1.0f;
+
+        int upperIndex = LowerBound(x);
+        if (upperIndex >= c_CDFSamples)
+            return 1.0f;
+
+        int lowerIndex = std::max(upperIndex - 1, 0);
+        if (lowerIndex == upperIndex)
+            return float(lowerIndex) / float(c_CDFSamples);
+
+        float lowerValue = Decode(m_CDFTable[lowerIndex]);
+        float upperValue = Decode(m_CDFTable[upperIndex]);
+        float fraction = (x - lowerValue) / (upperValue - lowerValue);
+        return (float(lowerIndex) + fraction) / float(c_CDFSamples);
+    }
+
+    // The index of the first entry whose decoded value is >= x, which is the number of entries less than x
+    int LowerBound(float x) const
+    {
+#if SIMD_AVX2()
+        // Lanes that compare true are -1, so subtracting the comparisons counts them
+        const __m256 scale = _mm256_set1_ps(1.0f / c_scale);
+        const __m256 vx = _mm256_set1_ps(x);
+        __m256i count = _mm256_setzero_si256();
+        for (int i = 0; i < c_paddedSamples; i += 16)
+        {
+            __m256i values = _mm256_loadu_si256((const __m256i*)&m_CDFTable[i]);
+            __m256 low = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(values))), scale);
+            __m256 high = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(values, 1))), scale);
+            __m256 lessLow = _mm256_cmp_ps(low, vx, _CMP_LT_OQ);
+            __m256 lessHigh = _mm256_cmp_ps(high, vx, _CMP_LT_OQ);
+            count = _mm256_sub_epi32(count, _mm256_add_epi32(_mm256_castps_si256(lessLow), _mm256_castps_si256(lessHigh)));
+
+            // The table is sorted, so once an entry isn't less than x, none of the later ones are either
+            if (_mm256_movemask_ps(_mm256_and_ps(lessLow, lessHigh)) != 0xFF)
+                break;
+        }
+
+        alignas(32) int lanes[8];
+        _mm256_store_si256((__m256i*)lanes, count);
+        return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + (lanes[4] + lanes[5]) + (lanes[6] + lanes[7]);
+#else
+        return int(std::lower_bound(m_CDFTable, m_CDFTable + c_CDFSamples, x, [](uint16_t value, float x) { return Decode(value) < x; }) - m_CDFTable);
+#endif
+    }
+
+    void PDF(const float* x, float* out, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = PDF(x[i]);
+    }
+
+    void CDF(const float* x, float* out, size_t count) const
+    {
+        size_t i = 0;
+#if SIMD_AVX2()
+        const __m256i lastIndex = _mm256_set1_epi32(c_CDFSamples - 1);
+        const __m256i lowBits = _mm256_set1_epi32(0xFFFF);
+        const __m256 scale = _mm256_set1_ps(1.0f / c_scale);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 v = _mm256_loadu_ps(x + i);
+            __m256 index = SIMDClamp(_mm256_mul_ps(v, _mm256_set1_ps(float(c_CDFSamples))), 0.0f, float(c_CDFSamples - 1));
+
+            // Gathering 32 bits at a 16 bit entry reads the entry after it too, which for the last entry is padding
+            __m256i index1 = _mm256_cvttps_epi32(index);
+            __m256i index2 = _mm256_min_epi32(_mm256_add_epi32(index1, _mm256_set1_epi32(1)), lastIndex);
+            __m256 value1 = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_i32gather_epi32((const int*)m_CDFTable, index1, 2), lowBits));
+            __m256 value2 = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_i32gather_epi32((const int*)m_CDFTable, index2, 2), lowBits));
+            __m256 fract = _mm256_sub_ps(index, _mm256_floor_ps(index));
+            __m256 result = SIMDLerp(_mm256_mul_ps(value1, scale), _mm256_mul_ps(value2, scale), fract);
+
+            // 0 below the range, 1 above it
+            result = _mm256_and_ps(result, _mm256_cmp_ps(v, _mm256_set1_ps(c_xmin), _CMP_GE_OQ));
+            result = _mm256_blendv_ps(result, _mm256_set1_ps(1.0f), _mm256_cmp_ps(v, _mm256_set1_ps(c_xmax), _CMP_GT_OQ));
+            _mm256_storeu_ps(out + i, result);
+        }
+#endif
+        for (; i < count; ++i)
+            out[i] = CDF(x[i]);
+    }
+
+    void ICDF(const float* x, float* out, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = ICDF(x[i]);
+    }
+
+    const uint16_t* m_CDFTable = nullptr;   // c_paddedSamples values
+};
+
+// Holds the compressed CDF tables of many distributions in one allocation.
+// Add() returns an index, and Get() makes a view of that table. Views are invalidated by Add(),
+// since the arena can grow, so add everything first.
+template <int TCDFSamples = 100>
+struct CompressedCDFArenaT
+{
+    typedef PDFCompressedViewT<TCDFSamples> View;
+
+    static const int c_CDFSamples = TCDFSamples;
+
+    template <typename TPDFFn, int TPDFSamples>
+    int Add(const PDFNumericT<TPDFFn, TPDFSamples, TCDFSamples>& pdf)
+    {
+        return Add(pdf.View());
+    }
+
+    int Add(const PDFNumericViewT<TCDFSamples>& pdf)
+    {
+        return Add(pdf.m_CDFTable);
+    }
+
+    // Adds a CDF table of c_CDFSamples sorted values in [0,1]
+    int Add(const float* CDFTable)
+    {
+        size_t begin = m_values.size();
+        m_values.resize(begin + View::c_paddedSamples, uint16_t(View::c_scale));
+        for (int i = 0; i < c_CDFSamples; ++i)
+            m_values[begin + i] = uint16_t(std::lround(double(Clamp(CDFTable[i], 0.0f, 1.0f)) * double(View::c_scale)));
+        return NumTables() - 1;
+    }
+
+    View Get(int index) const
+    {
+        return { &m_values[size_t(index) * View::c_paddedSamples] };
+    }
+
+    int NumTables() const
+    {
+        return int(m_values.size() / View::c_paddedSamples);
+    }
+
+    size_t SizeInBytes() const
+    {
+        return m_values.size() * sizeof(uint16_t);
+    }
+
+    void Reserve(int numTables)
+    {
+        m_values.reserve(size_t(numTables) * View::c_paddedSamples);
+    }
+
+    std::vector<uint16_t> m_values;
+};
+
+typedef CompressedCDFArenaT<> CompressedCDFArena;
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <new>
+#include <algorithm>
+
+#include "simd.h"
+#include "parallel.h"
+#include "instrumentation.h"
+
+// All pairs p-Wasserstein distances between N PDFs.
+// Each PDF's ICDF is evaluated once at the midpoints of M evenly spaced quantile cells, so that
+// W_p^p = average over the cells of abs(ICDF1 - ICDF2)^p. The distance matrix is then computed
+// in tiles of rows, like a matrix multiply, so the rows being compared stay in the cache.
+// For p = 2, abs(a-b)^2 = a.a + b.b - 2 a.b, so the distances come from dot products.
+
+// std::vector allocator for memory aligned to ALIGNMENT bytes
+template <typename T, size_t ALIGNMENT>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U, ALIGNMENT> other;
+    };
+
+    AlignedAllocator() = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, ALIGNMENT>&) {}
+
+    T* allocate(size_t count)
+    {
+        return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(ALIGNMENT)));
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        ::operator delete(p, std::align_val_t(ALIGNMENT));
+    }
+
+    template <typename U>
+    bool operator == (const AlignedAllocator<U, ALIGNMENT>&) const { return true; }
+
+    template <typename U>
+    bool operator != (const AlignedAllocator<U, ALIGNMENT>&) const { return false; }
+};
+
+// ICDF values of many PDFs on a shared quantile grid, one row per PDF.
+// Rows are 64 byte aligned and padded with zeros to a multiple of 16 floats.
+struct QuantileMatrix
+{
+    static const int c_rowAlignment = 16;
+
+    QuantileMatrix(int numRows, int numQuantiles)
+        : m_numRows(numRows)
+        , m_numQuantiles(numQuantiles)
+        , m_stride((numQuantiles + c_rowAlignment - 1) / c_rowAlignment * c_rowAlignment)
+    {
+        m_values.resize(size_t(m_numRows) * m_stride, 0.0f);
+        m_u.resize(m_numQuantiles);
+        INSTRUMENT_ALLOCATION("QuantileMatrix", (m_values.size() + m_u.size()) * sizeof(float));
+        for (int i = 0; i < m_numQuantiles; ++i)
+            m_u[i] = (float(i) + 0.5f) / float(m_numQuantiles);
+    }
+
+    template <typename PDF>
+    static QuantileMatrix FromPDFs(const PDF* pdfs, int count, int numQuantiles = 1024)
+    {
+        QuantileMatrix ret(count, numQuantiles);
+        ParallelFor(count,
+            [&](int row)
+            {
+                ret.SetRow(row, pdfs[row]);
+            }
+        );
+        return ret;
+    }
+
+    template <typename PDF>
+    static QuantileMatrix FromPDFs(const std::vector<PDF>& pdfs, int numQuantiles = 1024)
+    {
+        return FromPDFs(pdfs.data(), int(pdfs.size()), numQuantiles);
+    }
+
+    template <typename PDF>
+    void SetRow(int row, const PDF& pdf)
+    {
+        pdf.ICDF(m_u.data(), Row(row), m_numQuantiles);
+    }
+
+    float* Row(int row)
+    {
+        return &m_values[size_t(row) * m_stride];
+    }
+
+    const float* Row(int row) const
+    {
+        return &m_values[size_t(row) * m_stride];
+    }
+
+    int m_numRows = 0;
+    int m_numQuantiles = 0;
+    int m_stride = 0;
+    std::vector<float> m_u;
+    std::vector<float, AlignedAllocator<float, 64>> m_values;
+};
+
+// Sum of a[i]*b[i]. Accumulated in doubles, since the p = 2 path subtracts these from each other.
+// count is a multiple of 16 and both pointers are 64 byte aligned.
+inline double DotProduct(const float* a, const float* b, int count)
+{
+#if SIMD_AVX2()
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+    for (int i = 0; i < count; i += 8)
+    {
+        __m256 va = _mm256_load_ps(a + i);
+        __m256 vb = _mm256_load_ps(b + i);
+        __m256d aLow = _mm256_cvtps_pd(_mm256_castps256_ps128(va));
+        __m256d aHigh = _mm256_cvtps_pd(_mm256_extractf128_ps(va, 1));
+        __m256d bLow = _mm256_cvtps_pd(_mm256_castps256_ps128(vb));
+        __m256d bHigh = _mm256_cvtps_pd(_mm256_extractf128_ps(vb, 1));
+        sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(aLow, bLow));
+        sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(aHigh, bHigh));
+    }
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, _mm256_add_pd(sum0, sum1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#else
+    double ret = 0.0;
+    for (int i = 0; i < count; ++i)
+        ret += double(a[i]) * double(b[i]);
+    return ret;
+#endif
+}
+
+// Sum of abs(a[i]-b[i]), with the same requirements as DotProduct
+inline double SumAbsDifference(const float* a, const float* b, int count)
+{
+#if SIMD_AVX2()
+    const __m256 signMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    __m256d sum = _mm256_setzero_pd();
+    for (int i = 0; i < count; i += 8)
+    {
+        __m256 diff = _mm256_and_ps(_mm256_sub_ps(_mm256_load_ps(a + i), _mm256_load_ps(b + i)), signMask);
+        sum = _mm256_add_pd(sum, _mm256_cvtps_pd(_mm256_castps256_ps128(diff)));
+        sum = _mm256_add_pd(sum, _mm256_cvtps_pd(_mm256_extractf128_ps(diff, 1)));
+    }
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, sum);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#else
+    double ret = 0.0;
+    for (int i = 0; i < count; ++i)
+        ret += std::abs(double(a[i]) - double(b[i]));
+    return ret;
+#endif
+}
+
+// Sum of (a[i]-b[i])^2, with the same requirements as DotProduct.
+// Unlike a.a + b.b - 2 a.b, this doesn't lose precision when a and b are close.
+inline double SumSquaredDifference(const float* a, const float* b, int count)
+{
+#if SIMD_AVX2()
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+    for (int i = 0; i < count; i += 8)
+    {
+        __m256 diff = _mm256_sub_ps(_mm256_load_ps(a + i), _mm256_load_ps(b + i));
+        __m256d diffLow = _mm256_cvtps_pd(_mm256_castps256_ps128(diff));
+        __m256d diffHigh = _mm256_cvtps_pd(_mm256_extractf128_ps(diff, 1));
+        sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(diffLow, diffLow));
+        sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(diffHigh, diffHigh));
+    }
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, _mm256_add_pd(sum0, sum1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#else
+    double ret = 0.0;
+    for (int i = 0; i < count; ++i)
+    {
+        double diff = double(a[i]) - double(b[i]);
+        ret += diff * diff;
+    }
+    return ret;
+#endif
+}
+
+// Sum of abs(a[i]-b[i])^p
+inline double SumPowAbsDifference(const float* a, const float* b, int count, float p)
+{
+    double ret = 0.0;
+    for (int i = 0; i < count; ++i)
+        ret += std::pow(std::abs(double(a[i]) - double(b[i])), double(p));
+    return ret;
+}
+
+// Returns the numRows x numRows matrix of p-Wasserstein distances, row major
+inline std::vector<float> PWassersteinDistanceMatrix(float p, const QuantileMatrix& quantiles)
+{
+    // c_tileSize rows are compared against c_tileSize other rows, c_columnBlockSize quantiles at a time,
+    // which is 2 * 32 * 256 * 4 bytes = 64KB of rows being worked on at once.
+    static const int c_tileSize = 32;
+    static const int c_columnBlockSize = 256;
+
+    int numRows = quantiles.m_numRows;
+    std::vector<float> ret(size_t(numRows) * numRows, 0.0f);
+    INSTRUMENT_ALLOCATION("PWassersteinDistanceMatrix", ret.size() * sizeof(float) + numRows * sizeof(double));
+
+    // the squared length of each row, for the p = 2 path
+    std::vector<double> squaredLengths(numRows, 0.0);
+    if (p == 2.0f)
+    {
+        ParallelFor(numRows,
+            [&](int row)
+            {
+                squaredLengths[row] = DotProduct(quantiles.Row(row), quantiles.Row(row), quantiles.m_stride);
+            }
+        );
+    }
+
+    // The matrix is symmetric, so only the tiles on and above the diagonal are calculated
+    int numTiles = (numRows + c_tileSize - 1) / c_tileSize;
+    std::vector<std::pair<int, int>> tiles;
+    for (int tileI = 0; tileI < numTiles; ++tileI)
+        for (int tileJ = tileI; tileJ < numTiles; ++tileJ)
+            tiles.push_back({ tileI, tileJ });
+
+    ParallelFor(int(tiles.size()),
+        [&](int tileIndex)
+        {
+            int beginI = tiles[tileIndex].first * c_tileSize;
+            int endI = std::min(beginI + c_tileSize, numRows);
+            int beginJ = tiles[tileIndex].second * c_tileSize;
+            int endJ = std::min(beginJ + c_tileSize, numRows);
+
+            double sums[c_tileSize][c_tileSize] = {};
+            for (int columnBegin = 0; columnBegin < quantiles.m_stride; columnBegin += c_columnBlockSize)
+            {
+                int columnCount = std::min(c_columnBlockSize, quantiles.m_stride - columnBegin);
+                for (int i = beginI; i < endI; ++i)
+                {
+                    const float* rowI = quantiles.Row(i) + columnBegin;
+                    for (int j = std::max(beginJ, i + 1); j < endJ; ++j)
+                    {
+                        const float* rowJ = quantiles.Row(j) + columnBegin;
+                        double& sum = sums[i - beginI][j - beginJ];
+                        if (p == 2.0f)
+                            sum += DotProduct(rowI, rowJ, columnCount);
+                        else if (p == 1.0f)
+                            sum += SumAbsDifference(rowI, rowJ, columnCount);
+                        else
+                            sum += SumPowAbsDifference(rowI, rowJ, columnCount, p);
+                    }
+                }
+            }
+
+            for (int i = beginI; i < endI; ++i)
+            {
+                for (int j = std::max(beginJ, i + 1); j < endJ; ++j)
+                {
+                    double sum = sums[i - beginI][j - beginJ];
+                    if (p == 2.0f)
+                        sum = std::max(squaredLengths[i] + squaredLengths[j] - 2.0 * sum, 0.0);
+
+                    float distance = float(std::pow(sum / double(quantiles.m_numQuantiles), 1.0 / p));
+                    ret[size_t(i) * numRows + j] = distance;
+                    ret[size_t(j) * numRows + i] = distance;
+                }
+            }
+        }
+    );
+
+    return ret;
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include "simd.h"
+#include "samples.h"
+#include "histogram.h"
+
+// Watches a stream of values for a change in their distribution, by comparing the last windowSize values
+// (the current window) against the windowSize values before them (the reference window).
+//
+// Values are quantized to numBins bins over [xmin, xmax], and a ring buffer remembers the bin of every value
+// in the two windows. Each new value enters the current window, the oldest value of the current window moves
+// to the reference window, and the oldest value of the reference window leaves. Each window is a PDFHistogram,
+// so quantiles of either window are O(log n) queries.
+//
+// With both windows holding the same number of values at bin centers, W_1 = binWidth * sum over k of
+// abs(D[k]) / windowSize, where D[k] is the number of values in bins 0..k of the current window minus the number
+// in the reference window. A new value changes D by a constant over a few ranges of bins, so the sum is updated
+// over just those bins, 8 at a time with AVX2, instead of being recomputed from sorted windows.
+// Other p are computed on demand by walking the two histograms together, in O(numBins).
+struct DriftDetector
+{
+    DriftDetector(int windowSize, int numBins = 1024, float xmin = 0.0f, float xmax = 1.0f)
+        : m_windowSize(windowSize)
+        , m_reference(numBins, xmin, xmax)
+        , m_current(numBins, xmin, xmax)
+        , m_ringBuffer(2 * size_t(windowSize), 0)
+        , m_cumulativeDifference(numBins, 0)
+    {
+    }
+
+    void Add(float x)
+    {
+        int newBin = m_current.GetBin(x);
+
+        // (bin, change to D from that bin on) for each histogram change, at most 3 of them
+        std::pair<int, int> changes[3];
+        int numChanges = 0;
+
+        // The oldest value of the reference window leaves
+        if (m_numValues >= 2 * m_windowSize)
+        {
+            int bin = m_ringBuffer[m_ringIndex];
+            m_reference.AddMass(bin, -1.0);
+            changes[numChanges++] = { bin, 1 };
+        }
+
+        // The oldest value of the current window moves to the reference window
+        if (m_numValues >= m_windowSize)
+        {
+            int bin = m_ringBuffer[(m_ringIndex + m_windowSize) % m_ringBuffer.size()];
+            m_current.AddMass(bin, -1.0);
+            m_reference.AddMass(bin, 1.0);
+            changes[numChanges++] = { bin, -2 };
+        }
+
+        // The new value goes into the current window, and takes the place of the value that left in the ring buffer
+        m_current.AddMass(newBin, 1.0);
+        changes[numChanges++] = { newBin, 1 };
+        m_ringBuffer[m_ringIndex] = newBin;
+        m_ringIndex = (m_ringIndex + 1) % m_ringBuffer.size();
+        m_numValues = std::min<int64_t>(m_numValues + 1, 2 * int64_t(m_windowSize));
+
+        // Apply the changes to D as ranges of bins with a constant change. D of the last bin is the difference in the
+        // number of values, which doesn't count towards the distance, so it isn't stored.
+        std::sort(changes, changes + numChanges);
+        int delta = 0;
+        for (int i = 0; i < numChanges; ++i)
+        {
+            delta += changes[i].second;
+            int begin = changes[i].first;
+            int end = (i + 1 < numChanges) ? changes[i + 1].first : NumBins() - 1;
+            if (delta != 0 && begin < end)
+                m_sumAbsDifference += AddToRange(begin, end, delta);
+        }
+    }
+
+    // True once both windows are full. The distances are only meaningful after that.
+    bool IsFull() const
+    {
+        return m_numValues >= 2 * int64_t(m_windowSize);
+    }
+
+    // W_1 between the windows, in O(1)
+    float W1() const
+    {
+        float binWidth = (m_current.m_xmax - m_current.m_xmin) / float(NumBins());
+        return float(double(binWidth) * double(m_sumAbsDifference) / double(m_windowSize));
+    }
+
+    // W_p between the windows, in O(numBins)
+    float PWassersteinDistance(float p) const
+    {
+        std::vector<float> referenceCounts(NumBins());
+        std::vector<float> currentCounts(NumBins());
+        for (int bin = 0; bin < NumBins(); ++bin)
+        {
+            referenceCounts[bin] = float(m_reference.BinMass(bin));
+            currentCounts[bin] = float(m_current.BinMass(bin));
+        }
+
+        float binWidth = (m_current.m_xmax - m_current.m_xmin) / float(NumBins());
+        KahanSum sum;
+        SweepMonotoneCoupling(referenceCounts.data(), referenceCounts.size(), currentCounts.data(), currentCounts.size(),
+            [&](size_t index1, size_t index2, double mass)
+            {
+                double distance = double(binWidth) * std::abs(double(index1) - double(index2));
+                sum.Add(mass * std::pow(distance, double(p)));
+            }
+        );
+        return (float)std::pow(sum.Get(), 1.0 / p);
+    }
+
+    const PDFHistogram& ReferenceWindow() const
+    {
+        return m_reference;
+    }
+
+    const PDFHistogram& CurrentWindow() const
+    {
+        return m_current;
+    }
+
+    int NumBins() const
+    {
+        return m_current.NumBins();
+    }
+
+private:
+    // Adds delta to D[begin..end) and returns the change in the sum of abs(D)
+    int64_t AddToRange(int begin, int end, int delta)
+    {
+        int32_t* D = m_cumulativeDifference.data();
+        int64_t ret = 0;
+        int i = begin;
+#if SIMD_AVX2()
+        __m256i vDelta = _mm256_set1_epi32(delta);
+        __m256i vChange = _mm256_setzero_si256();
+        for (; i + 8 <= end; i += 8)
+        {
+            __m256i before = _mm256_loadu_si256((const __m256i*)&D[i]);
+            __m256i after = _mm256_add_epi32(before, vDelta);
+            _mm256_storeu_si256((__m256i*)&D[i], after);
+            vChange = _mm256_add_epi32(vChange, _mm256_sub_epi32(_mm256_abs_epi32(after), _mm256_abs_epi32(before)));
+        }
+
+        // each lane changes by at most 2 per bin, so the 32 bit lanes can't overflow
+        alignas(32) int32_t lanes[8];
+        _mm256_store_si256((__m256i*)lanes, vChange);
+        for (int lane = 0; lane < 8; ++lane)
+            ret += lanes[lane];
+#endif
+        for (; i < end; ++i)
+        {
+            int32_t before = D[i];
+            D[i] = before + delta;
+            ret += std::abs(D[i]) - std::abs(before);
+        }
+        return ret;
+    }
+
+    int m_windowSize = 0;
+    PDFHistogram m_reference;
+    PDFHistogram m_current;
+
+    // The bins of the values in both windows. The oldest value is at m_ringIndex, and the oldest value
+    // of the current window is m_windowSize after it.
+    std::vector<int> m_ringBuffer;
+    size_t m_ringIndex = 0;
+    int64_t m_numValues = 0;
+
+    std::vector<int32_t> m_cumulativeDifference;   // D
+    int64_t m_sumAbsDifference = 0;
+};
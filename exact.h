@@ -0,0 +1,219 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#include "numeric.h"
+#include "quantile.h"
+#include "adaptive.h"
+#include "histogram.h"
+#include "quadrature.h"
+
+// The ICDF of a PDFNumeric is piecewise linear, so W_p between two of them can be calculated exactly
+// by merging the knots of both ICDFs and integrating each segment in closed form.
+
+// A piecewise linear ICDF. Segment i goes from (m_u[i], m_x[i]) to (m_u[i+1], m_x[i+1]).
+// m_u is ascending and starts at 0 and ends at 1. Two knots can have the same u, which makes a jump in x.
+struct PiecewiseLinearICDF
+{
+    float Evaluate(int segment, double u) const
+    {
+        double u0 = m_u[segment];
+        double u1 = m_u[segment + 1];
+        double x0 = m_x[segment];
+        double x1 = m_x[segment + 1];
+        return float(x0 + (x1 - x0) * (u - u0) / (u1 - u0));
+    }
+
+    int NumSegments() const
+    {
+        return int(m_u.size()) - 1;
+    }
+
+    std::vector<float> m_u;
+    std::vector<float> m_x;
+};
+
+// Matches PDFNumeric::ICDF exactly: it is 0 up to the first CDF value, and then goes linearly
+// from (m_CDFTable[i], i / c_CDFSamples) to (m_CDFTable[i+1], (i+1) / c_CDFSamples).
+template <int TCDFSamples>
+PiecewiseLinearICDF GetICDFKnots(const PDFNumericViewT<TCDFSamples>& pdf)
+{
+    PiecewiseLinearICDF ret;
+    ret.m_u.reserve(TCDFSamples + 1);
+    ret.m_x.reserve(TCDFSamples + 1);
+
+    ret.m_u.push_back(0.0f);
+    ret.m_x.push_back(0.0f);
+    for (int i = 0; i < TCDFSamples; ++i)
+    {
+        ret.m_u.push_back(pdf.m_CDFTable[i]);
+        ret.m_x.push_back(float(i) / float(TCDFSamples));
+    }
+    return ret;
+}
+
+template <typename TPDFFn, int TPDFSamples, int TCDFSamples>
+PiecewiseLinearICDF GetICDFKnots(const PDFNumericT<TPDFFn, TPDFSamples, TCDFSamples>& pdf)
+{
+    return GetICDFKnots(pdf.View());
+}
+
+// The knots of a PDFQuantile are just its table, at evenly spaced u values
+inline PiecewiseLinearICDF GetICDFKnots(const PDFQuantile& pdf)
+{
+    PiecewiseLinearICDF ret;
+    ret.m_u.resize(pdf.m_ICDFTable.size());
+    for (size_t i = 0; i < ret.m_u.size(); ++i)
+        ret.m_u[i] = float(i) / float(pdf.NumSegments());
+    ret.m_x = pdf.m_ICDFTable;
+    return ret;
+}
+
+inline PiecewiseLinearICDF GetICDFKnots(const PDFNumericAdaptive& pdf)
+{
+    PiecewiseLinearICDF ret;
+    ret.m_u = pdf.m_CDF;
+    ret.m_x = pdf.m_x;
+    return ret;
+}
+
+// A histogram's CDF is linear across each bin, so the knots are the bin edges
+inline PiecewiseLinearICDF GetICDFKnots(const PDFHistogram& pdf)
+{
+    PiecewiseLinearICDF ret;
+    ret.m_u.reserve(pdf.NumBins() + 1);
+    ret.m_x.reserve(pdf.NumBins() + 1);
+
+    ret.m_u.push_back(0.0f);
+    ret.m_x.push_back(pdf.m_xmin);
+    double cumulative = 0.0;
+    for (int bin = 0; bin < pdf.NumBins(); ++bin)
+    {
+        cumulative += std::max(pdf.BinMass(bin), 0.0);
+        ret.m_u.push_back(pdf.TotalMass() > 0.0 ? std::min(float(cumulative / pdf.TotalMass()), 1.0f) : 0.0f);
+        ret.m_x.push_back(Lerp(pdf.m_xmin, pdf.m_xmax, float(bin + 1) / float(pdf.NumBins())));
+    }
+    ret.m_u.back() = 1.0f;
+    return ret;
+}
+
+// Integral over a segment of width w of abs(d(u))^p, where d goes linearly from d0 to d1
+inline double IntegrateAbsLinearPow(double d0, double d1, double w, double p)
+{
+    double a0 = std::abs(d0);
+    double a1 = std::abs(d1);
+
+    // If the line crosses zero, it is two pieces that each start at zero
+    if ((d0 < 0.0 && d1 > 0.0) || (d0 > 0.0 && d1 < 0.0))
+        return w * (std::pow(a0, p + 1.0) + std::pow(a1, p + 1.0)) / ((p + 1.0) * (a0 + a1));
+
+    // The closed form below divides by a1 - a0, so use the midpoint when the line is (nearly) flat
+    if (std::abs(a1 - a0) <= 1e-6 * (a0 + a1))
+        return w * std::pow(0.5 * (a0 + a1), p);
+
+    return w * (std::pow(a1, p + 1.0) - std::pow(a0, p + 1.0)) / ((p + 1.0) * (a1 - a0));
+}
+
+// Calls fn(u0, u1, segment1, segment2) for every interval of the merged knots of two piecewise linear ICDFs
+template <typename LAMBDA>
+void ForEachMergedSegment(const PiecewiseLinearICDF& icdf1, const PiecewiseLinearICDF& icdf2, const LAMBDA& fn)
+{
+    int segment1 = 0;
+    int segment2 = 0;
+    double u = 0.0;
+    while (segment1 < icdf1.NumSegments() && segment2 < icdf2.NumSegments())
+    {
+        // skip to the segments which contain u, which also skips zero width segments
+        while (segment1 < icdf1.NumSegments() && icdf1.m_u[segment1 + 1] <= u)
+            segment1++;
+        while (segment2 < icdf2.NumSegments() && icdf2.m_u[segment2 + 1] <= u)
+            segment2++;
+        if (segment1 >= icdf1.NumSegments() || segment2 >= icdf2.NumSegments())
+            break;
+
+        double nextU = std::min(icdf1.m_u[segment1 + 1], icdf2.m_u[segment2 + 1]);
+        fn(u, nextU, segment1, segment2);
+        u = nextU;
+    }
+}
+
+// Exact p-Wasserstein distance between two piecewise linear ICDFs, in O(n+m)
+inline WassersteinEstimate PWassersteinDistanceExact(float p, const PiecewiseLinearICDF& icdf1, const PiecewiseLinearICDF& icdf2)
+{
+    double total = 0.0;
+    ForEachMergedSegment(icdf1, icdf2,
+        [&](double u0, double u1, int segment1, int segment2)
+        {
+            double d0 = double(icdf1.Evaluate(segment1, u0)) - double(icdf2.Evaluate(segment2, u0));
+            double d1 = double(icdf1.Evaluate(segment1, u1)) - double(icdf2.Evaluate(segment2, u1));
+            total += IntegrateAbsLinearPow(d0, d1, u1 - u0, p);
+        }
+    );
+
+    WassersteinEstimate ret;
+    ret.distance = float(std::pow(total, 1.0 / p));
+    return ret;
+}
+
+template <typename TPDFFn1, int TPDFSamples1, int TCDFSamples1, typename TPDFFn2, int TPDFSamples2, int TCDFSamples2>
+WassersteinEstimate PWassersteinDistanceExact(float p, const PDFNumericT<TPDFFn1, TPDFSamples1, TCDFSamples1>& pdf1, const PDFNumericT<TPDFFn2, TPDFSamples2, TCDFSamples2>& pdf2)
+{
+    return PWassersteinDistanceExact(p, GetICDFKnots(pdf1), GetICDFKnots(pdf2));
+}
+
+// Piecewise linear ICDF vs analytic. The piecewise linear ICDF is linear between its knots and the analytic ICDF
+// is smooth there, so each segment is integrated separately with adaptive quadrature, which converges very quickly.
+template <typename PDF2>
+WassersteinEstimate PWassersteinDistanceExact(float p, const PiecewiseLinearICDF& icdf1, const PDF2& pdf2, float tolerance = 1e-6f)
+{
+    QuadratureResult total;
+    auto integrateSegments = [&](double integralTolerance)
+    {
+        total = QuadratureResult();
+        for (int segment = 0; segment < icdf1.NumSegments(); ++segment)
+        {
+            double u0 = icdf1.m_u[segment];
+            double u1 = icdf1.m_u[segment + 1];
+            if (u1 <= u0)
+                continue;
+
+            auto integrand = [&](double u)
+            {
+                double icdf = pdf2.ICDF(float(u));
+                return std::pow(std::abs(double(icdf1.Evaluate(segment, u)) - icdf), (double)p);
+            };
+
+            QuadratureResult result = IntegrateAdaptive(integrand, u0, u1, integralTolerance * (u1 - u0));
+            total.value += result.value;
+            total.error += result.error;
+            total.numEvaluations += result.numEvaluations;
+        }
+    };
+
+    // a single Kronrod rule per segment is usually already good enough to set the tolerance for the real pass
+    integrateSegments(std::numeric_limits<double>::max());
+    int roughEvaluations = total.numEvaluations;
+    if (total.error > GetIntegralTolerance(p, total.value, tolerance))
+        integrateSegments(GetIntegralTolerance(p, total.value, tolerance));
+    else
+        roughEvaluations = 0;
+    total.numEvaluations += roughEvaluations;
+
+    return MakeWassersteinEstimate(p, total);
+}
+
+// Table vs analytic
+template <typename TPDFFn, int TPDFSamples, int TCDFSamples, typename PDF2>
+WassersteinEstimate PWassersteinDistanceExact(float p, const PDFNumericT<TPDFFn, TPDFSamples, TCDFSamples>& pdf1, const PDF2& pdf2, float tolerance = 1e-6f)
+{
+    return PWassersteinDistanceExact(p, GetICDFKnots(pdf1), pdf2, tolerance);
+}
+
+template <typename PDF1, typename TPDFFn, int TPDFSamples, int TCDFSamples>
+WassersteinEstimate PWassersteinDistanceExact(float p, const PDF1& pdf1, const PDFNumericT<TPDFFn, TPDFSamples, TCDFSamples>& pdf2, float tolerance = 1e-6f)
+{
+    return PWassersteinDistanceExact(p, pdf2, pdf1, tolerance);
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+// A histogram over [xmin, xmax] whose bin masses can change at any time, used as a piecewise constant PDF.
+// The bin masses are kept in a Fenwick tree (binary indexed tree), so changing a bin, CDF and ICDF are all O(log n),
+// instead of rebuilding a table of prefix sums after every change. Masses don't need to be normalized.
+// https://en.wikipedia.org/wiki/Fenwick_tree
+struct PDFHistogram
+{
+    PDFHistogram(int numBins, float xmin = 0.0f, float xmax = 1.0f)
+        : m_xmin(xmin)
+        , m_xmax(xmax)
+        , m_masses(numBins, 0.0)
+        , m_tree(numBins + 1, 0.0)
+    {
+        // The largest power of 2 <= numBins is where the ICDF descent starts
+        m_topStep = 1;
+        while (m_topStep * 2 <= numBins)
+            m_topStep *= 2;
+    }
+
+    // Adds mass to a bin. Negative mass takes it away.
+    void AddMass(int bin, double mass)
+    {
+        m_masses[bin] += mass;
+        m_total += mass;
+        for (int i = bin + 1; i < (int)m_tree.size(); i += i & -i)
+            m_tree[i] += mass;
+    }
+
+    void SetMass(int bin, double mass)
+    {
+        AddMass(bin, mass - m_masses[bin]);
+    }
+
+    // Adds mass to the bin that x falls in
+    void Add(float x, double mass = 1.0)
+    {
+        AddMass(GetBin(x), mass);
+    }
+
+    void Remove(float x, double mass = 1.0)
+    {
+        AddMass(GetBin(x), -mass);
+    }
+
+    int GetBin(float x) const
+    {
+        return Clamp(int((x - m_xmin) / (m_xmax - m_xmin) * float(NumBins())), 0, NumBins() - 1);
+    }
+
+    // The total mass of the bins before this one
+    double PrefixMass(int bin) const
+    {
+        double ret = 0.0;
+        for (int i = bin; i > 0; i -= i & -i)
+            ret += m_tree[i];
+        return ret;
+    }
+
+    float PDF(float x) const
+    {
+        if (x < m_xmin || x > m_xmax || m_total <= 0.0)
+            return 0.0f;
+
+        float binWidth = (m_xmax - m_xmin) / float(NumBins());
+        return float(std::max(m_masses[GetBin(x)], 0.0) / m_total) / binWidth;
+    }
+
+    float CDF(float x) const
+    {
+        if (x <= m_xmin || m_total <= 0.0)
+            return 0.0f;
+
+        if (x >= m_xmax)
+            return 1.0f;
+
+        float binPosition = (x - m_xmin) / (m_xmax - m_xmin) * float(NumBins());
+        int bin = std::min(int(binPosition), NumBins() - 1);
+        double fraction = double(binPosition) - double(bin);
+        double mass = PrefixMass(bin) + fraction * std::max(m_masses[bin], 0.0);
+        return Clamp(float(mass / m_total), 0.0f, 1.0f);
+    }
+
+    float ICDF(float x) const
+    {
+        if (m_total <= 0.0)
+            return m_xmin;
+
+        // Walk down the tree to find the last bin whose prefix mass is below the target mass
+        double target = double(Clamp(x, 0.0f, 1.0f)) * m_total;
+        int bin = 0;
+        for (int step = m_topStep; step > 0; step /= 2)
+        {
+            if (bin + step < (int)m_tree.size() && m_tree[bin + step] < target)
+            {
+                bin += step;
+                target -= m_tree[bin];
+            }
+        }
+        bin = std::min(bin, NumBins() - 1);
+
+        double mass = m_masses[bin];
+        double fraction = mass > 0.0 ? Clamp(target / mass, 0.0, 1.0) : 0.0;
+        return Lerp(m_xmin, m_xmax, float((double(bin) + fraction) / double(NumBins())));
+    }
+
+    void PDF(const float* x, float* out, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = PDF(x[i]);
+    }
+
+    void CDF(const float* x, float* out, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = CDF(x[i]);
+    }
+
+    void ICDF(const float* x, float* out, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = ICDF(x[i]);
+    }
+
+    int NumBins() const
+    {
+        return int(m_masses.size());
+    }
+
+    double TotalMass() const
+    {
+        return m_total;
+    }
+
+    double BinMass(int bin) const
+    {
+        return m_masses[bin];
+    }
+
+    float m_xmin = 0.0f;
+    float m_xmax = 1.0f;
+
+private:
+    std::vector<double> m_masses;
+    std::vector<double> m_tree;     // m_tree[i] is the mass of bins [i - (i & -i), i)
+    double m_total = 0.0;
+    int m_topStep = 1;
+};
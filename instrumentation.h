@@ -0,0 +1,190 @@
+#pragma once
+
+// Counters for the hot paths: PDF / CDF / ICDF calls, lower_bound searches and how many entries they probe,
+// table build time, and bytes allocated per routine.
+//
+// It is compiled out unless INSTRUMENTATION() is defined to true before including anything, for example
+// with -D"INSTRUMENTATION()=true". Unless it is, all of the INSTRUMENT_ macros do nothing.
+// Each thread counts into its own counters, so counting doesn't make the threads fight over cache lines,
+// and Instrumentation::Get().Snapshot() adds up the counters of every thread.
+#ifndef INSTRUMENTATION
+    #define INSTRUMENTATION() false
+#endif
+
+#include <cstdint>
+#include <type_traits>
+
+enum class InstrumentationCounter
+{
+    PDFCalls,
+    CDFCalls,
+    ICDFCalls,
+    LowerBoundSearches,
+    LowerBoundProbes,
+    TableBuilds,
+    TableBuildNanoseconds,
+
+    Count
+};
+
+inline const char* InstrumentationCounterName(InstrumentationCounter counter)
+{
+    static const char* c_names[] =
+    {
+        "PDFCalls",
+        "CDFCalls",
+        "ICDFCalls",
+        "lowerBoundSearches",
+        "lowerBoundProbes",
+        "tableBuilds",
+        "tableBuildNanoseconds",
+    };
+    static_assert(sizeof(c_names) / sizeof(c_names[0]) == size_t(InstrumentationCounter::Count), "Every counter needs a name");
+    return c_names[int(counter)];
+}
+
+#if INSTRUMENTATION()
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <memory>
+
+struct InstrumentationSnapshot
+{
+    uint64_t counters[int(InstrumentationCounter::Count)] = {};
+    std::map<std::string, uint64_t> bytesAllocated;
+};
+
+// The counters of one thread. Only that thread writes them, so they are updated with a plain load and store,
+// and are only atomic so that another thread can read them at the same time.
+struct InstrumentationThreadCounters
+{
+    std::atomic<uint64_t> counters[int(InstrumentationCounter::Count)] = {};
+
+    std::mutex bytesAllocatedMutex;
+    std::map<const char*, uint64_t> bytesAllocated;
+};
+
+struct Instrumentation
+{
+    static Instrumentation& Get()
+    {
+        static Instrumentation instrumentation;
+        return instrumentation;
+    }
+
+    static InstrumentationThreadCounters& Local()
+    {
+        thread_local InstrumentationThreadCounters* counters = Get().AddThread();
+        return *counters;
+    }
+
+    InstrumentationSnapshot Snapshot()
+    {
+        InstrumentationSnapshot ret;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& thread : m_threads)
+        {
+            for (int i = 0; i < int(InstrumentationCounter::Count); ++i)
+                ret.counters[i] += thread->counters[i].load(std::memory_order_relaxed);
+
+            std::lock_guard<std::mutex> bytesLock(thread->bytesAllocatedMutex);
+            for (const auto& routine : thread->bytesAllocated)
+                ret.bytesAllocated[routine.first] += routine.second;
+        }
+        return ret;
+    }
+
+    void Reset()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& thread : m_threads)
+        {
+            for (auto& counter : thread->counters)
+                counter.store(0, std::memory_order_relaxed);
+
+            std::lock_guard<std::mutex> bytesLock(thread->bytesAllocatedMutex);
+            thread->bytesAllocated.clear();
+        }
+    }
+
+private:
+    // Threads' counters are kept after the thread exits, so their counts still show up in snapshots
+    InstrumentationThreadCounters* AddThread()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_threads.push_back(std::make_unique<InstrumentationThreadCounters>());
+        return m_threads.back().get();
+    }
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<InstrumentationThreadCounters>> m_threads;
+};
+
+inline void InstrumentationAdd(InstrumentationCounter counter, uint64_t amount)
+{
+    std::atomic<uint64_t>& value = Instrumentation::Local().counters[int(counter)];
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+inline void InstrumentationAddAllocation(const char* routine, uint64_t bytes)
+{
+    InstrumentationThreadCounters& counters = Instrumentation::Local();
+    std::lock_guard<std::mutex> lock(counters.bytesAllocatedMutex);
+    counters.bytesAllocated[routine] += bytes;
+}
+
+inline uint64_t InstrumentationNanoseconds()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// The number of entries std::lower_bound looks at in a range of this size
+inline uint64_t InstrumentationLowerBoundProbes(uint64_t count)
+{
+    uint64_t ret = 0;
+    while (count > 0)
+    {
+        ret++;
+        count /= 2;
+    }
+    return ret;
+}
+
+inline uint64_t InstrumentationPopCount(uint32_t bits)
+{
+    uint64_t ret = 0;
+    for (; bits; bits &= bits - 1)
+        ret++;
+    return ret;
+}
+
+// These all check std::is_constant_evaluated(), so they can be used in constexpr functions
+#define INSTRUMENT_COUNT(counter, amount) \
+    do { if (!std::is_constant_evaluated()) InstrumentationAdd(InstrumentationCounter::counter, uint64_t(amount)); } while (0)
+
+#define INSTRUMENT_LOWER_BOUND(rangeSize) \
+    do { INSTRUMENT_COUNT(LowerBoundSearches, 1); INSTRUMENT_COUNT(LowerBoundProbes, InstrumentationLowerBoundProbes(uint64_t(rangeSize))); } while (0)
+
+#define INSTRUMENT_ALLOCATION(routine, bytes) \
+    do { if (!std::is_constant_evaluated()) InstrumentationAddAllocation(routine, uint64_t(bytes)); } while (0)
+
+#define INSTRUMENT_TIMER_BEGIN(name) \
+    uint64_t name = std::is_constant_evaluated() ? 0 : InstrumentationNanoseconds()
+
+#define INSTRUMENT_TIMER_END(counter, name) \
+    INSTRUMENT_COUNT(counter, InstrumentationNanoseconds() - name)
+
+#else
+
+#define INSTRUMENT_COUNT(counter, amount) do { } while (0)
+#define INSTRUMENT_LOWER_BOUND(rangeSize) do { } while (0)
+#define INSTRUMENT_ALLOCATION(routine, bytes) do { } while (0)
+#define INSTRUMENT_TIMER_BEGIN(name) do { } while (0)
+#define INSTRUMENT_TIMER_END(counter, name) do { } while (0)
+
+#endif
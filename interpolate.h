@@ -0,0 +1,234 @@
+#pragma once
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "parallel.h"
+#include "instrumentation.h"
+#include "writer.h"
+
+// Displacement interpolation between two PDFs, written to a CSV file for graphing.
+// InterpolatePDFs_PDF lerps the PDFs themselves, for comparison, and InterpolatePDFs_ICDF lerps the ICDFs,
+// which is the optimal transport (Wasserstein) interpolation.
+// Files are written by OutputWriter on its own thread, so call OutputWriter::Get().Flush() before reading them.
+
+// "t=50%" for the middle column of 3
+inline std::string GetStepColumnName(int column, int numSteps)
+{
+    char name[32];
+    sprintf_s(name, "t=%i%%", int(100.0f * float(column) / float(numSteps - 1)));
+    return name;
+}
+
+// The interpolated PDFs, one column per step
+template <typename PDF1, typename PDF2>
+OutputTable MakeInterpolationTable_PDF(const PDF1& pdf1, const PDF2& pdf2, int numSteps = 5, int numValues = 100)
+{
+    // Evaluate both PDFs once, using the batched PDF functions
+    std::vector<float> x(numValues);
+    for (int i = 0; i < numValues; ++i)
+        x[i] = float(i) / float(numValues - 1);
+    std::vector<float> y1(numValues);
+    std::vector<float> y2(numValues);
+    INSTRUMENT_ALLOCATION("InterpolatePDFs_PDF", (x.size() + y1.size() + y2.size() + size_t(numSteps) * numValues) * sizeof(float));
+    pdf1.PDF(x.data(), y1.data(), numValues);
+    pdf2.PDF(x.data(), y2.data(), numValues);
+
+    // Make the interpolated PDFs
+    std::vector<std::vector<float>> PDFs(numSteps);
+    for (int step = 0; step < numSteps; ++step)
+    {
+        // Make the PDF
+        float t = float(step) / float(numSteps - 1);
+        std::vector<float>& PDF = PDFs[step];
+        PDF.resize(numValues, 0.0f);
+        for (int i = 0; i < numValues; ++i)
+            PDF[i] = Lerp(y1[i], y2[i], t);
+
+        // normalize PDF
+        float total = 0.0f;
+        for (float f : PDF)
+            total += f;
+        for (float& f : PDF)
+            f /= total;
+    }
+
+    OutputTable ret;
+    for (int column = 0; column < numSteps; ++column)
+        ret.AddColumn(GetStepColumnName(column, numSteps), std::move(PDFs[column]));
+    return ret;
+}
+
+template <typename PDF1, typename PDF2>
+void InterpolatePDFs_PDF(const char* fileName, const PDF1& pdf1, const PDF2& pdf2, int numSteps = 5, int numValues = 100)
+{
+    printf("%s...\n", fileName);
+
+    OutputTable table = MakeInterpolationTable_PDF(pdf1, pdf2, numSteps, numValues);
+    for (int column = 0; column < numSteps; ++column)
+    {
+        float total = 0.0f;
+        for (float f : table.m_columns[column])
+            total += f;
+
+        printf("Column %i total = %0.2f\n", column, total);
+    }
+
+    // Hand it to the writer thread
+    OutputWriter::Get().Write(fileName, std::move(table));
+    printf("\n");
+}
+
+// The interpolated PDFs, one column per step, then the actual PDFs and CDFs of both for comparison
+template <typename PDF1, typename PDF2>
+OutputTable MakeInterpolationTable_ICDF(const PDF1& pdf1, const PDF2& pdf2, int numSteps = 5, int numValuesICDF = 1000000, int numValuesPDF = 100)
+{
+    // Make the interpolated PDFs. The steps are independent, so they are done in parallel.
+    std::vector<std::vector<float>> PDFs(numSteps);
+    std::vector<std::vector<float>> CDFs(numSteps);
+    INSTRUMENT_ALLOCATION("InterpolatePDFs_ICDF", size_t(numSteps) * (2 * numValuesPDF + 1) * sizeof(float) + 4 * numValuesPDF * sizeof(float));
+    ParallelFor(numSteps,
+        [&](int step)
+        {
+            float t = float(step) / float(numSteps - 1);
+
+            // The interpolated ICDF, as a table of numValuesICDF values, with the last one being 1.0.
+            // Only the few entries that the searches below look at are calculated, instead of storing the whole table.
+            auto ICDF = [&](int i)
+            {
+                if (i == numValuesICDF - 1)
+                    return 1.0f;
+                float x = float(i) / float(numValuesICDF - 1);
+                float y1 = pdf1.ICDF(x);
+                float y2 = pdf2.ICDF(x);
+                return Lerp(y1, y2, t);
+            };
+
+            // make the CDF by inverting the ICDF
+            std::vector<float>& CDF = CDFs[step];
+            CDF.resize(numValuesPDF + 1, 0.0f);
+            int searchBegin = 0;
+            for (int i = 0; i <= numValuesPDF; ++i)
+            {
+                // we are shifting x over because we get the PDF through forward differencing
+                // which causes an offset
+                float x = (float(i) + 0.5f) / float(numValuesPDF + 1);
+
+                // std::lower_bound on the ICDF table. x increases each iteration, so the search can start where the last one ended.
+                int upperIndex = searchBegin;
+                int count = numValuesICDF - searchBegin;
+                while (count > 0)
+                {
+                    int halfCount = count / 2;
+                    if (ICDF(upperIndex + halfCount) < x)
+                    {
+                        upperIndex += halfCount + 1;
+                        count -= halfCount + 1;
+                    }
+                    else
+                    {
+                        count = halfCount;
+                    }
+                }
+                searchBegin = upperIndex;
+
+                if (upperIndex == numValuesICDF)
+                {
+                    printf("Could not find value %f in ICDF table! (index %i/%i)\n", x, i, numValuesPDF);
+                }
+                else
+                {
+                    int lowerIndex = std::max(upperIndex - 1, 0);
+
+                    if (upperIndex == lowerIndex)
+                    {
+                        CDF[i] = float(lowerIndex) / float(numValuesPDF);
+                    }
+                    else
+                    {
+                        float lowerValue = ICDF(lowerIndex);
+                        float upperValue = ICDF(upperIndex);
+
+                        float fraction = (x - lowerValue) / (upperValue - lowerValue);
+
+                        CDF[i] = (float(lowerIndex) + fraction) / float(numValuesPDF);
+                    }
+                }
+            }
+
+            // normalize the CDF
+            for (float& f : CDF)
+                f /= CDF[numValuesPDF];
+
+            // make the PDF from the CDF
+            std::vector<float>& PDF = PDFs[step];
+            PDF.resize(numValuesPDF, 0.0f);
+            for (int i = 0; i < numValuesPDF; ++i)
+                PDF[i] = CDF[i + 1] - CDF[i];
+
+            // normalize the PDF
+            float total = 0.0f;
+            for (float f : PDF)
+                total += f;
+            for (float& f : PDF)
+                f /= total;
+        }
+    );
+
+    // make the actual pdf values
+    std::vector<float> actualPDF1(numValuesPDF, 0.0f);
+    std::vector<float> actualPDF2(numValuesPDF, 0.0f);
+    std::vector<float> actualCDF1(numValuesPDF, 0.0f);
+    std::vector<float> actualCDF2(numValuesPDF, 0.0f);
+    {
+        float total1 = 0.0f;
+        float total2 = 0.0f;
+        for (int row = 0; row < numValuesPDF; ++row)
+        {
+            float x = float(row) / float(numValuesPDF - 1);
+            actualPDF1[row] = pdf1.PDF(x);
+            actualPDF2[row] = pdf2.PDF(x);
+            actualCDF1[row] = pdf1.CDF(x);
+            actualCDF2[row] = pdf2.CDF(x);
+            total1 += actualPDF1[row];
+            total2 += actualPDF2[row];
+        }
+
+        for (float& f : actualPDF1)
+            f /= total1;
+        for (float& f : actualPDF2)
+            f /= total2;
+        for (float& f : actualCDF1)
+            f /= actualCDF1[numValuesPDF - 1];
+        for (float& f : actualCDF2)
+            f /= actualCDF2[numValuesPDF - 1];
+    }
+
+    // The CDFs have an extra value at the end, which isn't written
+    std::vector<float> CDF1(CDFs[0].begin(), CDFs[0].begin() + numValuesPDF);
+    std::vector<float> CDF2(CDFs[numSteps - 1].begin(), CDFs[numSteps - 1].begin() + numValuesPDF);
+
+    OutputTable ret;
+    for (int column = 0; column < numSteps; ++column)
+        ret.AddColumn(GetStepColumnName(column, numSteps), std::move(PDFs[column]));
+    ret.AddColumn("Actual PDF1", std::move(actualPDF1));
+    ret.AddColumn("Actual PDF2", std::move(actualPDF2));
+    ret.AddColumn("CDF1", std::move(CDF1));
+    ret.AddColumn("CDF2", std::move(CDF2));
+    ret.AddColumn("Actual CDF1", std::move(actualCDF1));
+    ret.AddColumn("Actual CDF2", std::move(actualCDF2));
+    return ret;
+}
+
+template <typename PDF1, typename PDF2>
+void InterpolatePDFs_ICDF(const char* fileName, const PDF1& pdf1, const PDF2& pdf2, int numSteps = 5, int numValuesICDF = 1000000, int numValuesPDF = 100)
+{
+    printf("%s...\n", fileName);
+
+    // Hand it to the writer thread
+    OutputWriter::Get().Write(fileName, MakeInterpolationTable_ICDF(pdf1, pdf2, numSteps, numValuesICDF, numValuesPDF));
+
+    printf("\n");
+}
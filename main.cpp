@@ -3,245 +3,487 @@
 #include <vector>
 #include <algorithm>
 #include <random>
+#include <chrono>
+#include <cstring>
 
 #define DETERMINISTIC() false
 #include "utils.h"
+#include "parallel.h"
+#include "pcg8.h"
 
 #include "analytic.h"
 #include "numeric.h"
-
-template <typename PDF1, typename PDF2>
-float PWassersteinDistance(float p, const PDF1& pdf1, const PDF2& pdf2, int numSamples = 10000000)
+#include "quadrature.h"
+#include "adaptive.h"
+#include "exact.h"
+#include "sampling.h"
+#include "samples.h"
+#include "sketch.h"
+#include "quantile.h"
+#include "distancematrix.h"
+#include "transport.h"
+#include "sliced.h"
+#include "histogram.h"
+#include "drift.h"
+#include "tablecache.h"
+#include "compressed.h"
+#include "interpolate.h"
+#include "plan.h"
+#include "neighbors.h"
+#include "manifest.h"
+
+// Times PDFNumeric::ICDF (guide table) against PDFNumeric::ICDFBinarySearch, and verifies that they give identical results
+void BenchmarkICDF(const char* name, const PDFNumeric& pdf, int numSamples = 10000000)
 {
-    // https://www.imagedatascience.com/transport/OTCrashCourse.pdf page 45
-    // Integral from 0 to 1 of abs(ICDF1(x) - ICDF2(x))^p
-    // Then take the result to ^(1/p)
+    std::vector<float> x(numSamples);
     pcg32_random_t rng = GetRNG();
-    double ret = 0.0;
+    for (float& f : x)
+        f = RandomFloat01(rng);
+
+    std::vector<float> guideResults(numSamples);
+    std::vector<float> binarySearchResults(numSamples);
+
+    auto start = std::chrono::high_resolution_clock::now();
     for (int i = 0; i < numSamples; ++i)
-    {
-        float x = RandomFloat01(rng);
-        float icdf1 = pdf1.ICDF(x);
-        float icdf2 = pdf2.ICDF(x);
-        double y = std::pow(std::abs((double)icdf1 - (double)icdf2), p);
-        ret = Lerp(ret, y, 1.0 / double(i + 1));
-    }
-    return (float)std::pow(ret, 1.0f / p);
+        guideResults[i] = pdf.ICDF(x[i]);
+    std::chrono::duration<double> guideSeconds = std::chrono::high_resolution_clock::now() - start;
+
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < numSamples; ++i)
+        binarySearchResults[i] = pdf.ICDFBinarySearch(x[i]);
+    std::chrono::duration<double> binarySearchSeconds = std::chrono::high_resolution_clock::now() - start;
+
+    float maxDifference = 0.0f;
+    for (int i = 0; i < numSamples; ++i)
+        maxDifference = std::max(maxDifference, std::abs(guideResults[i] - binarySearchResults[i]));
+
+    printf("(ICDF benchmark) %s: guide table %0.2f ns, binary search %0.2f ns, max difference %f\n", name,
+        1e9 * guideSeconds.count() / double(numSamples), 1e9 * binarySearchSeconds.count() / double(numSamples), maxDifference);
 }
 
-template <typename PDF1, typename PDF2>
-void InterpolatePDFs_PDF(const char* fileName, const PDF1& pdf1, const PDF2& pdf2, int numSteps = 5, int numValues = 100)
+int main(int argc, char** argv)
 {
-    printf("%s...\n", fileName);
+    // OT1D <manifest> [table cache file] runs the tasks in the manifest, instead of the examples below.
+    // OT1D -tables <table cache file> runs the examples, and saves the table cache example's tables to the file.
+    const char* tablesFileName = nullptr;
+    if (argc > 2 && strcmp(argv[1], "-tables") == 0)
+        tablesFileName = argv[2];
+    else if (argc > 1)
+        return RunManifest(argv[1], (argc > 2) ? argv[2] : nullptr);
+
+    PDFNumeric pdftTableUniform([](float x) { return 1.0f; });
+    PDFNumeric pdftTableLinear([](float x) { return 2.0f * x; });
+    PDFNumeric pdftTableQuadratic([](float x) { return 3.0f * x * x; });
+
+    printf("(analytical p=2) Uniform To Linear = %f\n", PWassersteinDistance(2.0f, PDFUniform(), PDFLinear()));
+    printf("(analytical p=2) Uniform To Quadratic = %f\n", PWassersteinDistance(2.0f, PDFUniform(), PDFQuadratic()));
+    printf("(analytical p=2) Linear To Quadratic = %f\n\n", PWassersteinDistance<>(2.0f, PDFLinear(), PDFQuadratic()));
+
+    printf("(table p=2) Uniform To Linear = %f\n", PWassersteinDistance(2.0f, pdftTableUniform, pdftTableLinear));
+    printf("(table p=2) Uniform To Quadratic = %f\n", PWassersteinDistance(2.0f, pdftTableUniform, pdftTableQuadratic));
+    printf("(table p=2) Linear To Quadratic = %f\n\n", PWassersteinDistance(2.0f, pdftTableLinear, pdftTableQuadratic));
+
+    printf("(table p=1) Uniform To Linear = %f\n", PWassersteinDistance(1.0f, pdftTableUniform, pdftTableLinear));
+    printf("(table p=1) Uniform To Quadratic = %f\n", PWassersteinDistance(1.0f, pdftTableUniform, pdftTableQuadratic));
+    printf("(table p=1) Linear To Quadratic = %f\n\n", PWassersteinDistance(1.0f, pdftTableLinear, pdftTableQuadratic));
+
+    printf("(table p=3) Uniform To Linear = %f\n", PWassersteinDistance(3.0f, pdftTableUniform, pdftTableLinear));
+    printf("(table p=3) Uniform To Quadratic = %f\n", PWassersteinDistance(3.0f, pdftTableUniform, pdftTableQuadratic));
+    printf("(table p=3) Linear To Quadratic = %f\n\n", PWassersteinDistance(3.0f, pdftTableLinear, pdftTableQuadratic));
 
-    // Make the interpolated PDFs
-    std::vector<std::vector<float>> PDFs(numSteps);
-    for (int step = 0; step < numSteps; ++step)
     {
-        // Make the PDF
-        float t = float(step) / float(numSteps - 1);
-        std::vector<float>& PDF = PDFs[step];
-        PDF.resize(numValues, 0.0f);
-        for (int i = 0; i < numValues; ++i)
+        WassersteinEstimate estimate = PWassersteinDistanceQuadrature(2.0f, PDFUniform(), PDFQuadratic());
+        printf("(analytical quadrature p=2) Uniform To Quadratic = %f +/- %f (%i evaluations)\n", estimate.distance, estimate.errorBound, estimate.numEvaluations);
+
+        estimate = PWassersteinDistanceQuadrature(2.0f, pdftTableUniform, pdftTableQuadratic);
+        printf("(table quadrature p=2) Uniform To Quadratic = %f +/- %f (%i evaluations)\n", estimate.distance, estimate.errorBound, estimate.numEvaluations);
+
+        estimate = PWassersteinDistanceQuadrature(1.0f, pdftTableLinear, pdftTableQuadratic);
+        printf("(table quadrature p=1) Linear To Quadratic = %f +/- %f (%i evaluations)\n\n", estimate.distance, estimate.errorBound, estimate.numEvaluations);
+    }
+
+    {
+        const char* sequenceNames[] = { "white noise", "stratified", "R2", "sobol", "owen sobol" };
+        SamplingSettings settings;
+        for (int sequence = 0; sequence < 5; ++sequence)
         {
-            float x = float(i) / float(numValues - 1);
-            float y1 = pdf1.PDF(x);
-            float y2 = pdf2.PDF(x);
-            PDF[i] = Lerp(y1, y2, t);
+            settings.sequence = SampleSequence(sequence);
+            WassersteinEstimate estimate = PWassersteinDistanceSampled(2.0f, pdftTableUniform, pdftTableQuadratic, settings);
+            printf("(table %s p=2) Uniform To Quadratic = %f +/- %f (%i samples)\n", sequenceNames[sequence], estimate.distance, estimate.errorBound, estimate.numEvaluations);
         }
+        printf("\n");
+    }
 
-        // normalize PDF
-        float total = 0.0f;
-        for (float f : PDF)
-            total += f;
-        for (float& f : PDF)
-            f /= total;
+    printf("(table exact p=2) Uniform To Linear = %f\n", PWassersteinDistanceExact(2.0f, pdftTableUniform, pdftTableLinear).distance);
+    printf("(table exact p=2) Uniform To Quadratic = %f\n", PWassersteinDistanceExact(2.0f, pdftTableUniform, pdftTableQuadratic).distance);
+    printf("(table exact p=1) Linear To Quadratic = %f\n", PWassersteinDistanceExact(1.0f, pdftTableLinear, pdftTableQuadratic).distance);
+    printf("(table exact p=3) Linear To Quadratic = %f\n", PWassersteinDistanceExact(3.0f, pdftTableLinear, pdftTableQuadratic).distance);
+    {
+        // Tables built at compile time, which call the density directly instead of through a std::function
+        constexpr auto pdftConstexprLinear = MakePDFNumeric<1000, 100>([](float x) { return 2.0f * x; });
+        constexpr auto pdftConstexprQuadratic = MakePDFNumeric<1000, 100>([](float x) { return 3.0f * x * x; });
+        printf("(constexpr table exact p=2) Linear To Quadratic = %f\n", PWassersteinDistanceExact(2.0f, pdftConstexprLinear, pdftConstexprQuadratic).distance);
+    }
+    {
+        WassersteinEstimate estimate = PWassersteinDistanceExact(2.0f, pdftTableUniform, PDFQuadratic());
+        printf("(table vs analytical exact p=2) Uniform To Quadratic = %f +/- %f (%i evaluations)\n\n", estimate.distance, estimate.errorBound, estimate.numEvaluations);
     }
 
-    // Write it to a file
-    FILE* file = nullptr;
-    fopen_s(&file, fileName, "wt");
+    PDFNumeric pdftTableGauss1([](float x) { x -= 0.2f; return exp(-x * x / (2.0f * 0.1f * 0.1f)); });
+    PDFNumeric pdftTableGauss2([](float x) { x -= 0.6f; return exp(-x * x / (2.0f * 0.15f * 0.15f)); });
+    // Distance between sample sets drawn from the linear and quadratic PDFs, which should match the analytical distance
+    {
+        pcg32_random_t rng = GetRNG();
+        std::vector<float> samplesLinear(1000000);
+        std::vector<float> samplesQuadratic(1500000);
+        for (float& f : samplesLinear)
+            f = PDFLinear().ICDF(RandomFloat01(rng));
+        for (float& f : samplesQuadratic)
+            f = PDFQuadratic().ICDF(RandomFloat01(rng));
+
+        printf("(samples p=2) Linear To Quadratic = %f\n", PWassersteinDistanceSamples(2.0f, samplesLinear, samplesQuadratic));
+        printf("(samples p=1) Linear To Quadratic = %f\n\n", PWassersteinDistanceSamples(1.0f, samplesLinear, samplesQuadratic));
+
+        // The transport plan between the same sample sets, streamed through, with the cost added up as it goes
+        TransportPlanCost cost1(1.0f, samplesLinear.data(), samplesQuadratic.data());
+        TransportPlanCost cost2(2.0f, samplesLinear.data(), samplesQuadratic.data());
+        size_t numEntries = ComputeTransportPlan(samplesLinear.data(), nullptr, samplesLinear.size(), samplesQuadratic.data(), nullptr, samplesQuadratic.size(),
+            [&](const TransportPlanEntry* entries, size_t count)
+            {
+                cost1(entries, count);
+                cost2(entries, count);
+            }
+        );
+        printf("(plan) Linear To Quadratic: %zu entries, p=2 cost = %f, p=1 cost = %f\n", numEntries, cost2.Get(), cost1.Get());
+    }
 
-    for (int column = 0; column < numSteps; ++column)
-        fprintf(file, "\"t=%i%%\",", int(100.0f * float(column) / float(numSteps - 1)));
-    fprintf(file, "\n");
+    // The transport plan between two histograms with different bins, which is also saved to a file
+    {
+        float positions1[] = { 0.1f, 0.3f, 0.5f, 0.7f };
+        float weights1[] = { 1.0f, 2.0f, 3.0f, 4.0f };
+        float positions2[] = { 0.2f, 0.6f, 0.9f };
+        float weights2[] = { 5.0f, 3.0f, 2.0f };
+        std::vector<TransportPlanEntry> plan = ComputeTransportPlan(positions1, weights1, 4, positions2, weights2, 3);
+
+        TransportPlanFileWriter planFile("_TransportPlan.bin", 4, 3);
+        planFile(plan.data(), plan.size());
+        planFile.Close();
+
+        for (const TransportPlanEntry& entry : plan)
+            printf("(plan) histogram %0.1f -> %0.1f: %f\n", positions1[entry.index1], positions2[entry.index2], entry.mass);
+
+        TransportPlanCost cost(2.0f, positions1, positions2);
+        cost.Add(plan.data(), plan.size());
+        printf("(plan) histogram p=2 cost = %f\n\n", cost.Get());
+    }
 
-    for (int row = 0; row < numValues; ++row)
+    // Stream samples of Gauss1 into sketches on several threads, merge them, and compare the result to Gauss1
     {
-        for (int column = 0; column < numSteps; ++column)
-            fprintf(file, "\"%f\",", PDFs[column][row]);
-        fprintf(file, "\n");
+        static const int c_numShards = 4;
+        static const int c_samplesPerShard = 250000;
+        std::vector<PDFSketch> shards;
+        for (int shard = 0; shard < c_numShards; ++shard)
+            shards.emplace_back(200, shard);
+
+        uint64_t seed = GetRNGSeed();
+        ParallelFor(c_numShards,
+            [&](int shard)
+            {
+                pcg32_random_t rng = GetRNG(seed, shard);
+                for (int i = 0; i < c_samplesPerShard; ++i)
+                    shards[shard].Add(pdftTableGauss1.ICDF(RandomFloat01(rng)));
+            }
+        );
+
+        PDFSketch& sketch = shards[0];
+        for (int shard = 1; shard < c_numShards; ++shard)
+            sketch.Merge(shards[shard]);
+        sketch.Finalize();
+
+        WassersteinEstimate estimate = PWassersteinDistanceQuadrature(1.0f, sketch, pdftTableGauss1);
+        printf("(sketch p=1) Gauss1 sketch (%i values stored of %i) To Gauss1 = %f\n\n", int(sketch.NumItems()), int(sketch.Count()), estimate.distance);
     }
 
-    for (int column = 0; column < numSteps; ++column)
+    // Barycenters. The halfway barycenter of two PDFs is half of the distance from each of them.
     {
-        float total = 0.0f;
-        for (float f : PDFs[column])
-            total += f;
+        std::vector<PDFNumeric> gaussians = { pdftTableGauss1, pdftTableGauss2 };
+        PDFQuantile barycenter = MakeWassersteinBarycenter(gaussians, { 0.5f, 0.5f });
 
-        printf("Column %i total = %0.2f\n", column, total);
+        printf("(barycenter p=2) Gauss1 To Gauss2 = %f\n", PWassersteinDistanceExact(2.0f, pdftTableGauss1, pdftTableGauss2).distance);
+        printf("(barycenter p=2) Gauss1 To Barycenter = %f\n", PWassersteinDistanceExact(2.0f, GetICDFKnots(PDFQuantile::FromPDF(pdftTableGauss1)), GetICDFKnots(barycenter)).distance);
+        printf("(barycenter p=2) Gauss2 To Barycenter = %f\n\n", PWassersteinDistanceExact(2.0f, GetICDFKnots(PDFQuantile::FromPDF(pdftTableGauss2)), GetICDFKnots(barycenter)).distance);
     }
 
-    fclose(file);
-    printf("\n");
-}
+    // Adaptive knot placement, compared to a table with a knot at every PDF sample
+    {
+        auto gauss1 = [](float x) { x -= 0.2f; return exp(-x * x / (2.0f * 0.1f * 0.1f)); };
+        auto gauss2 = [](float x) { x -= 0.6f; return exp(-x * x / (2.0f * 0.15f * 0.15f)); };
+        PDFNumericAdaptive reference(gauss1, 0.0f);
+        for (float tolerance : { 1e-2f, 1e-3f, 1e-4f })
+        {
+            PDFNumericAdaptive adaptive(gauss1, tolerance);
+            float maxError = 0.0f;
+            for (int i = 0; i <= 100000; ++i)
+                maxError = std::max(maxError, std::abs(adaptive.ICDF(float(i) / 100000.0f) - reference.ICDF(float(i) / 100000.0f)));
+            printf("(adaptive table) Gauss1 tolerance %f: %i knots, max ICDF error %f\n", tolerance, adaptive.NumKnots(), maxError);
+        }
 
-template <typename PDF1, typename PDF2>
-void InterpolatePDFs_ICDF(const char* fileName, const PDF1& pdf1, const PDF2& pdf2, int numSteps = 5, int numValuesICDF = 1000000, int numValuesPDF = 100)
-{
-    printf("%s...\n", fileName);
+        PDFNumericAdaptive adaptiveGauss1(gauss1);
+        PDFNumericAdaptive adaptiveGauss2(gauss2);
+        printf("(adaptive table exact p=2) Gauss1 To Gauss2 = %f\n\n", PWassersteinDistanceExact(2.0f, GetICDFKnots(adaptiveGauss1), GetICDFKnots(adaptiveGauss2)).distance);
+    }
 
-    // Make the interpolated PDFs
-    std::vector<std::vector<float>> PDFs(numSteps);
-    std::vector<std::vector<float>> CDFs(numSteps);
-    for (int step = 0; step < numSteps; ++step)
+    // All pairs distances between the tables
     {
-        // make the ICDF
-        float t = float(step) / float(numSteps - 1);
-        std::vector<float> ICDF;
-        ICDF.resize(numValuesICDF, 0.0f);
-        for (int i = 0; i < numValuesICDF; ++i)
+        const char* names[] = { "Uniform", "Linear", "Quadratic", "Gauss1", "Gauss2" };
+        std::vector<PDFNumeric> tables = { pdftTableUniform, pdftTableLinear, pdftTableQuadratic, pdftTableGauss1, pdftTableGauss2 };
+        QuantileMatrix quantiles = QuantileMatrix::FromPDFs(tables);
+        std::vector<float> distances = PWassersteinDistanceMatrix(2.0f, quantiles);
+
+        printf("(distance matrix p=2)");
+        for (const char* name : names)
+            printf(" %10s", name);
+        printf("\n");
+        for (int i = 0; i < (int)tables.size(); ++i)
         {
-            float x = float(i) / float(numValuesICDF - 1);
-            float y1 = pdf1.ICDF(x);
-            float y2 = pdf2.ICDF(x);
-            ICDF[i] = Lerp(y1, y2, t);
+            printf("%21s", names[i]);
+            for (int j = 0; j < (int)tables.size(); ++j)
+                printf(" %10f", distances[i * tables.size() + j]);
+            printf("\n");
         }
-        ICDF[numValuesICDF - 1] = 1.0f;
+        printf("\n");
+    }
+
+    // Find the most similar distributions in a corpus of gaussians, with the vantage point tree and by scanning every one
+    {
+        pcg32_random_t rng = GetRNG();
+        auto makeGauss = [&]()
+        {
+            float mean = 0.2f + 0.6f * RandomFloat01(rng);
+            float sigma = 0.03f + 0.15f * RandomFloat01(rng);
+            return MakePDFNumeric<1000, 100>([mean, sigma](float x) { x -= mean; return exp(-x * x / (2.0f * sigma * sigma)); });
+        };
+
+        std::vector<decltype(makeGauss())> corpus;
+        std::vector<decltype(makeGauss())> queries;
+        for (int i = 0; i < 10000; ++i)
+            corpus.push_back(makeGauss());
+        for (int i = 0; i < 100; ++i)
+            queries.push_back(makeGauss());
+
+        W2NearestNeighborIndex index = W2NearestNeighborIndex::FromPDFs(corpus, 256);
+        QuantileMatrix queryRows = index.MakeQueries(queries);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<std::vector<W2Neighbor>> treeResults = index.KNearest(queryRows, 5);
+        std::chrono::duration<double> treeSeconds = std::chrono::high_resolution_clock::now() - start;
+
+        start = std::chrono::high_resolution_clock::now();
+        std::vector<std::vector<W2Neighbor>> scanResults = index.KNearestScan(queryRows, 5);
+        std::chrono::duration<double> scanSeconds = std::chrono::high_resolution_clock::now() - start;
+
+        int numDifferent = 0;
+        for (size_t query = 0; query < treeResults.size(); ++query)
+            for (size_t i = 0; i < treeResults[query].size(); ++i)
+                numDifferent += (treeResults[query][i].index != scanResults[query][i].index) ? 1 : 0;
+
+        printf("(W2 nearest neighbors) 5 nearest of 100 queries in 10000 distributions: tree %0.2f ms, scan %0.2f ms, %i different\n",
+            1000.0 * treeSeconds.count(), 1000.0 * scanSeconds.count(), numDifferent);
+        printf("(W2 nearest neighbors) nearest to query 0 is %i at distance %f, %zu within 0.01\n\n",
+            treeResults[0][0].index, treeResults[0][0].distance, index.WithinRadius(queryRows, 0, 0.01f).size());
+    }
+
+    // Remap samples of Gauss1 to Gauss2, and halfway there. The moments should match Gauss2 and the halfway barycenter.
+    {
+        static const int c_numValues = 10000000;
+        std::vector<float> values(c_numValues);
+        pcg32_random_t rng = GetRNG();
+        for (float& f : values)
+            f = pdftTableGauss1.ICDF(RandomFloat01(rng));
 
-        // make the CDF by inverting the ICDF
-        std::vector<float>& CDF = CDFs[step];
-        CDF.resize(numValuesPDF + 1, 0.0f);
-        for (int i = 0; i <= numValuesPDF; ++i)
+        std::vector<float> halfway(c_numValues);
+        TransportMap(pdftTableGauss1, pdftTableGauss2, values.data(), halfway.data(), values.size(), 0.5f);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        TransportMap(pdftTableGauss1, pdftTableGauss2, values);
+        std::chrono::duration<double> seconds = std::chrono::high_resolution_clock::now() - start;
+
+        auto printMoments = [](const char* name, const std::vector<float>& values)
         {
-            // we are shifting x over because we get the PDF through forward differencing
-            // which causes an offset
-            float x = (float(i) + 0.5f) / float(numValuesPDF + 1);
+            double mean = 0.0;
+            for (float f : values)
+                mean += f;
+            mean /= double(values.size());
+            double variance = 0.0;
+            for (float f : values)
+                variance += (f - mean) * (f - mean);
+            variance /= double(values.size());
+            printf("(transport map) %s: mean %f, standard deviation %f\n", name, mean, std::sqrt(variance));
+        };
+        printMoments("Gauss1 halfway to Gauss2", halfway);
+        printMoments("Gauss1 mapped to Gauss2", values);
+        printf("(transport map) %0.2f ns per value\n\n", 1e9 * seconds.count() / double(c_numValues));
+    }
 
-            auto it = std::lower_bound(ICDF.begin(), ICDF.end(), x);
-            if (it == ICDF.end())
-            {
-                printf("Could not find value %f in ICDF table! (index %i/%i)\n", x, i, numValuesPDF);
-            }
-            else
+    // A live histogram of Gauss1 samples, which is then changed over to Gauss2 samples a batch at a time
+    {
+        static const int c_batchSize = 100000;
+        PDFHistogram histogram(1000);
+        pcg32_random_t rng = GetRNG();
+        std::vector<float> values(c_batchSize);
+        for (float& f : values)
+        {
+            f = pdftTableGauss1.ICDF(RandomFloat01(rng));
+            histogram.Add(f);
+        }
+        printf("(histogram exact p=2) Gauss1 histogram To Gauss1 = %f\n", PWassersteinDistanceExact(2.0f, GetICDFKnots(histogram), GetICDFKnots(pdftTableGauss1)).distance);
+
+        for (int batch = 0; batch < 4; ++batch)
+        {
+            for (int i = batch * c_batchSize / 4; i < (batch + 1) * c_batchSize / 4; ++i)
             {
-                int upperIndex = int(it - ICDF.begin());
-                int lowerIndex = std::max(upperIndex - 1, 0);
-
-                if (upperIndex == lowerIndex)
-                {
-                    CDF[i] = float(lowerIndex) / float(numValuesPDF);
-                }
-                else
-                {
-                    float lowerValue = ICDF[lowerIndex];
-                    float upperValue = ICDF[upperIndex];
-
-                    float fraction = (x - lowerValue) / (upperValue - lowerValue);
-
-                    CDF[i] = (float(lowerIndex) + fraction) / float(numValuesPDF);
-                }
+                histogram.Remove(values[i]);
+                histogram.Add(pdftTableGauss2.ICDF(RandomFloat01(rng)));
             }
+            printf("(histogram p=2) %i%% Gauss2 histogram To Gauss2 = %f\n", 25 * (batch + 1), PWassersteinDistance(2.0f, histogram, pdftTableGauss2, 1000000));
         }
-
-        // normalize the CDF
-        for (float& f : CDF)
-            f /= CDF[numValuesPDF];
-
-        // make the PDF from the CDF
-        std::vector<float>& PDF = PDFs[step];
-        PDF.resize(numValuesPDF, 0.0f);
-        for (int i = 0; i < numValuesPDF; ++i)
-            PDF[i] = CDF[i + 1] - CDF[i];
-
-        // normalize the PDF
-        float total = 0.0f;
-        for (float f : PDF)
-            total += f;
-        for (float& f : PDF)
-            f /= total;
+        printf("\n");
     }
 
-    // Write it to a file
-    FILE* file = nullptr;
-    fopen_s(&file, fileName, "wt");
-
-    for (int column = 0; column < numSteps; ++column)
-        fprintf(file, "\"t=%i%%\",", int(100.0f * float(column) / float(numSteps - 1)));
-    fprintf(file, "\"Actual PDF1\",\"Actual PDF2\",");
-    fprintf(file, "\"CDF1\",\"CDF2\",");
-    fprintf(file, "\"Actual CDF1\",\"Actual CDF2\",");
-    fprintf(file, "\n");
-
-    // make the actual pdf values
-    std::vector<float> actualPDF1(numValuesPDF, 0.0f);
-    std::vector<float> actualPDF2(numValuesPDF, 0.0f);
-    std::vector<float> actualCDF1(numValuesPDF, 0.0f);
-    std::vector<float> actualCDF2(numValuesPDF, 0.0f);
+    // Drift detection on a stream of Gauss1 values that turns into Gauss2 values halfway through
     {
-        float total1 = 0.0f;
-        float total2 = 0.0f;
-        for (int row = 0; row < numValuesPDF; ++row)
+        static const int c_numValues = 10000000;
+        static const int c_windowSize = 100000;
+        DriftDetector detector(c_windowSize);
+        pcg32_random_t rng = GetRNG();
+        std::vector<float> values(c_numValues);
+        for (int i = 0; i < c_numValues; ++i)
+            values[i] = (i < c_numValues / 2 ? pdftTableGauss1 : pdftTableGauss2).ICDF(RandomFloat01(rng));
+
+        float maxW1 = 0.0f;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < c_numValues; ++i)
         {
-            float x = float(row) / float(numValuesPDF - 1);
-            actualPDF1[row] = pdf1.PDF(x);
-            actualPDF2[row] = pdf2.PDF(x);
-            actualCDF1[row] = pdf1.CDF(x);
-            actualCDF2[row] = pdf2.CDF(x);
-            total1 += actualPDF1[row];
-            total2 += actualPDF2[row];
+            detector.Add(values[i]);
+            if (detector.IsFull())
+                maxW1 = std::max(maxW1, detector.W1());
         }
+        std::chrono::duration<double> seconds = std::chrono::high_resolution_clock::now() - start;
 
-        for (float& f : actualPDF1)
-            f /= total1;
-        for (float& f : actualPDF2)
-            f /= total2;
-        for (float& f : actualCDF1)
-            f /= actualCDF1[numValuesPDF - 1];
-        for (float& f : actualCDF2)
-            f /= actualCDF2[numValuesPDF - 1];
+        printf("(drift p=1) max W1 between windows = %f, final W1 = %f, final W2 = %f\n", maxW1, detector.W1(), detector.PWassersteinDistance(2.0f));
+        printf("(drift) %0.2f million values per second\n\n", double(c_numValues) / seconds.count() / 1000000.0);
     }
 
-    for (int row = 0; row < numValuesPDF; ++row)
+    // Building tables, and if a table cache file was given, saving them to it, then using them straight from the memory mapped file
     {
-        for (int column = 0; column < numSteps; ++column)
-            fprintf(file, "\"%f\",", PDFs[column][row]);
+        static const int c_numTables = 1000;
+        auto getIdentifier = [](int index)
+        {
+            char identifier[64];
+            sprintf_s(identifier, "gauss mean=%f sigma=0.1", float(index) / float(c_numTables));
+            return std::string(identifier);
+        };
+        auto getPDF = [](int index)
+        {
+            float mean = float(index) / float(c_numTables);
+            return [mean](float x) { x -= mean; return exp(-x * x / (2.0f * 0.1f * 0.1f)); };
+        };
+
+        // The builder has no file, so every table is built
+        std::vector<PDFTableCache::View> builtViews(c_numTables);
+        auto start = std::chrono::high_resolution_clock::now();
+        PDFTableCache builder("");
+        ParallelFor(c_numTables,
+            [&](int index)
+            {
+                builtViews[index] = builder.Get(getIdentifier(index).c_str(), getPDF(index));
+            }
+        );
+        std::chrono::duration<double> buildSeconds = std::chrono::high_resolution_clock::now() - start;
 
-        fprintf(file, "\"%f\",\"%f\",", actualPDF1[row], actualPDF2[row]);
-        fprintf(file, "\"%f\",\"%f\",", CDFs[0][row], CDFs[numSteps - 1][row]);
-        fprintf(file, "\"%f\",\"%f\",", actualCDF1[row], actualCDF2[row]);
-        fprintf(file, "\n");
+        if (!tablesFileName)
+        {
+            printf("(table cache) %i tables: built in %0.2f ms. Run with -tables <file> to save and load them\n\n", c_numTables, 1000.0 * buildSeconds.count());
+        }
+        else if (!builder.Write(tablesFileName))
+        {
+            printf("Could not write table cache %s\n\n", tablesFileName);
+        }
+        else
+        {
+            start = std::chrono::high_resolution_clock::now();
+            PDFTableCache cache(tablesFileName);
+            std::vector<PDFTableCache::View> views(c_numTables);
+            for (int index = 0; index < c_numTables; ++index)
+                views[index] = cache.Get(getIdentifier(index).c_str(), getPDF(index));
+            std::chrono::duration<double> loadSeconds = std::chrono::high_resolution_clock::now() - start;
+
+            float maxDifference = 0.0f;
+            for (int index = 0; index < c_numTables; ++index)
+                for (int i = 0; i <= 1000; ++i)
+                    maxDifference = std::max(maxDifference, std::abs(views[index].ICDF(float(i) / 1000.0f) - builtViews[index].ICDF(float(i) / 1000.0f)));
+
+            printf("(table cache) %i tables: built in %0.2f ms, saved to %s and loaded in %0.2f ms with %i rebuilt, max ICDF difference %f\n\n",
+                c_numTables, 1000.0 * buildSeconds.count(), tablesFileName, 1000.0 * loadSeconds.count(), int(cache.NumBuilt()), maxDifference);
+        }
     }
 
-    fclose(file);
-
-    printf("\n");
-}
-
-int main(int argc, char** argv)
-{
-    PDFNumeric pdftTableUniform([](float x) { return 1.0f; });
-    PDFNumeric pdftTableLinear([](float x) { return 2.0f * x; });
-    PDFNumeric pdftTableQuadratic([](float x) { return 3.0f * x * x; });
-
-    printf("(analytical p=2) Uniform To Linear = %f\n", PWassersteinDistance(2.0f, PDFUniform(), PDFLinear()));
-    printf("(analytical p=2) Uniform To Quadratic = %f\n", PWassersteinDistance(2.0f, PDFUniform(), PDFQuadratic()));
-    printf("(analytical p=2) Linear To Quadratic = %f\n\n", PWassersteinDistance<>(2.0f, PDFLinear(), PDFQuadratic()));
-
-    printf("(table p=2) Uniform To Linear = %f\n", PWassersteinDistance(2.0f, pdftTableUniform, pdftTableLinear));
-    printf("(table p=2) Uniform To Quadratic = %f\n", PWassersteinDistance(2.0f, pdftTableUniform, pdftTableQuadratic));
-    printf("(table p=2) Linear To Quadratic = %f\n\n", PWassersteinDistance(2.0f, pdftTableLinear, pdftTableQuadratic));
+    // Compressed CDF tables of many distributions in one arena
+    {
+        static const int c_numTables = 1000;
+        CompressedCDFArena arena;
+        arena.Reserve(c_numTables);
+        float maxICDFError = 0.0f;
+        for (int index = 0; index < c_numTables; ++index)
+        {
+            float mean = float(index) / float(c_numTables);
+            PDFNumeric table([mean](float x) { x -= mean; return exp(-x * x / (2.0f * 0.1f * 0.1f)); });
+            CompressedCDFArena::View view = arena.Get(arena.Add(table));
+            for (int i = 1; i < 1000; ++i)
+                maxICDFError = std::max(maxICDFError, std::abs(view.ICDF(float(i) / 1000.0f) - table.ICDF(float(i) / 1000.0f)));
+        }
+        printf("(compressed tables) %i tables in %i bytes (%i bytes each, vs %i for PDFNumeric tables), max ICDF error %f\n",
+            c_numTables, int(arena.SizeInBytes()), int(arena.SizeInBytes() / c_numTables), int(sizeof(PDFNumeric) - sizeof(PDFNumeric::PDFFn)), maxICDFError);
+        printf("(compressed tables p=2) Gauss mean 0.2 To Gauss mean 0.6 = %f\n\n", PWassersteinDistance(2.0f, arena.Get(200), arena.Get(600)));
+    }
 
-    printf("(table p=1) Uniform To Linear = %f\n", PWassersteinDistance(1.0f, pdftTableUniform, pdftTableLinear));
-    printf("(table p=1) Uniform To Quadratic = %f\n", PWassersteinDistance(1.0f, pdftTableUniform, pdftTableQuadratic));
-    printf("(table p=1) Linear To Quadratic = %f\n\n", PWassersteinDistance(1.0f, pdftTableLinear, pdftTableQuadratic));
+    // Sliced distance between two 3D normal distributions, one moved by 0.3 on the x axis.
+    // Projected onto direction d, the distance is abs(0.3 * d.x), so SW_2 = 0.3 / sqrt(3) = 0.173205
+    {
+        static const int c_numPoints = 100000;
+        pcg32_random_t rng = GetRNG();
+        auto makePoints = [&rng](float offsetX)
+        {
+            std::vector<float> points(c_numPoints * 3);
+            for (size_t i = 0; i < points.size(); i += 2)
+            {
+                float radius = std::sqrt(-2.0f * std::log(1.0f - RandomFloat01(rng)));
+                float angle = 2.0f * 3.14159265359f * RandomFloat01(rng);
+                points[i] = 0.1f * radius * std::cos(angle);
+                points[i + 1] = 0.1f * radius * std::sin(angle);
+            }
+            for (size_t i = 0; i < points.size(); i += 3)
+                points[i] += offsetX;
+            return PointSet::FromInterleaved(points.data(), 3, c_numPoints);
+        };
+        PointSet points1 = makePoints(0.0f);
+        PointSet points2 = makePoints(0.3f);
+
+        SlicedSettings settings;
+        settings.tolerance = 0.005f;
+        settings.directions = SliceDirections::Random;
+        WassersteinEstimate estimate = SlicedPWassersteinDistance(2.0f, points1, points2, settings);
+        printf("(sliced p=2 random directions) 3D normal To moved 3D normal = %f +/- %f (%i slices)\n", estimate.distance, estimate.errorBound, estimate.numEvaluations);
+
+        settings.directions = SliceDirections::R;
+        estimate = SlicedPWassersteinDistance(2.0f, points1, points2, settings);
+        printf("(sliced p=2 R directions) 3D normal To moved 3D normal = %f +/- %f (%i slices)\n\n", estimate.distance, estimate.errorBound, estimate.numEvaluations);
+    }
 
-    printf("(table p=3) Uniform To Linear = %f\n", PWassersteinDistance(3.0f, pdftTableUniform, pdftTableLinear));
-    printf("(table p=3) Uniform To Quadratic = %f\n", PWassersteinDistance(3.0f, pdftTableUniform, pdftTableQuadratic));
-    printf("(table p=3) Linear To Quadratic = %f\n\n", PWassersteinDistance(3.0f, pdftTableLinear, pdftTableQuadratic));
+    BenchmarkICDF("Linear", pdftTableLinear);
+    BenchmarkICDF("Gauss", pdftTableGauss1);
+    printf("\n");
 
-    PDFNumeric pdftTableGauss1([](float x) { x -= 0.2f; return exp(-x * x / (2.0f * 0.1f * 0.1f)); });
-    PDFNumeric pdftTableGauss2([](float x) { x -= 0.6f; return exp(-x * x / (2.0f * 0.15f * 0.15f)); });
     InterpolatePDFs_PDF("_Gauss2Gauss_PDF.csv", pdftTableGauss1, pdftTableGauss2);
     InterpolatePDFs_ICDF("_Gauss2Gauss_CDF.csv", pdftTableGauss1, pdftTableGauss2);
 
@@ -254,5 +496,11 @@ int main(int argc, char** argv)
     InterpolatePDFs_PDF("_Linear2Quadratic_PDF.csv", PDFLinear(), PDFQuadratic());
     InterpolatePDFs_ICDF("_Linear2Quadratic_CDF.csv", PDFLinear(), PDFQuadratic());
 
+    // The same interpolation in the binary columnar format, for other tools to load
+    InterpolatePDFs_ICDF("_Linear2Quadratic_CDF.bin", PDFLinear(), PDFQuadratic());
+
+    // Wait for the files to finish writing
+    OutputWriter::Get().Flush();
+
     return 0;
 }
@@ -0,0 +1,511 @@
+#pragma once
+
+#include <stdio.h>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <variant>
+#include <charconv>
+#include <algorithm>
+#include <type_traits>
+
+#include "utils.h"
+#include "parallel.h"
+#include "analytic.h"
+#include "numeric.h"
+#include "quadrature.h"
+#include "sampling.h"
+#include "exact.h"
+#include "tablecache.h"
+#include "interpolate.h"
+#include "writer.h"
+
+// Runs a batch of distance and interpolation tasks from a manifest file, all in parallel.
+//
+// A manifest has one definition or task per line. Blank lines and anything after a # are ignored.
+//   distribution <name> uniform | linear | quadratic
+//   distribution <name> gauss <mean> <sigma>
+//   distribution <name> polynomial <c0> [c1 c2 ...]        density c0 + c1 x + c2 x^2 + ..., clamped to >= 0
+//   distance <name1> <name2> [p=2] [method=sampled|quadrature|exact] [samples=10000000]
+//   interpolate <name1> <name2> <file> [mode=icdf|pdf] [steps=5]
+// Everything is on [0,1]. uniform, linear and quadratic are the analytic distributions, and the others are
+// PDFNumeric tables, whose densities can't be zero everywhere. method=exact needs at least one table, and
+// otherwise uses quadrature, which is what gets printed.
+// Interpolation files are CSV, or binary if the file name ends in .bin, and no two tasks can write the same file.
+//
+// Every table is built once, before any tasks run, no matter how many tasks use it, and tables of identical
+// distributions are shared even if they have different names. If a table cache file is given, tables are read
+// from it, and any new ones are written back to it at the end.
+// Tasks run on the thread pool, and the parallel loops inside of each task share the same threads.
+// Distances are printed in manifest order once everything is done, so the output doesn't depend on the timing.
+
+enum class ManifestDistributionType
+{
+    Uniform,
+    Linear,
+    Quadratic,
+    Gauss,
+    Polynomial
+};
+
+struct ManifestDistribution
+{
+    std::string name;
+    ManifestDistributionType type = ManifestDistributionType::Uniform;
+    std::vector<float> parameters;
+
+    // The density of a table distribution
+    float operator()(float x) const
+    {
+        if (type == ManifestDistributionType::Gauss)
+        {
+            x -= parameters[0];
+            return std::exp(-x * x / (2.0f * parameters[1] * parameters[1]));
+        }
+
+        // Horner's method
+        float ret = 0.0f;
+        for (auto it = parameters.rbegin(); it != parameters.rend(); ++it)
+            ret = ret * x + *it;
+        return std::max(ret, 0.0f);
+    }
+
+    bool IsTable() const
+    {
+        return type == ManifestDistributionType::Gauss || type == ManifestDistributionType::Polynomial;
+    }
+
+    // Whether the density adds up to more than zero at the points a table samples it at, the same way the table
+    // adds them up to normalize it. Tables of densities that don't would divide by zero.
+    bool HasMass() const
+    {
+        float total = 0.0f;
+        for (int index = 0; index < PDFTableCache::c_PDFSamples; ++index)
+            total += (*this)(float(index) / float(PDFTableCache::c_PDFSamples - 1));
+        return total > 0.0f && std::isfinite(total);
+    }
+
+    // Identifies the table in the cache. It comes from the parameters and not the name, so the same distribution
+    // gets the same table under any name.
+    std::string TableIdentifier() const
+    {
+        std::string ret = (type == ManifestDistributionType::Gauss) ? "gauss" : "polynomial";
+        char number[32];
+        for (float parameter : parameters)
+        {
+            sprintf_s(number, " %.9g", parameter);
+            ret += number;
+        }
+        return ret;
+    }
+};
+
+enum class ManifestDistanceMethod
+{
+    Sampled,
+    Quadrature,
+    Exact
+};
+
+struct ManifestDistanceTask
+{
+    int distribution1 = 0;
+    int distribution2 = 0;
+    float p = 2.0f;
+    ManifestDistanceMethod method = ManifestDistanceMethod::Sampled;
+    int numSamples = 10000000;
+};
+
+struct ManifestInterpolationTask
+{
+    int distribution1 = 0;
+    int distribution2 = 0;
+    std::string fileName;
+    bool interpolateICDF = true;
+    int numSteps = 5;
+};
+
+typedef std::variant<ManifestDistanceTask, ManifestInterpolationTask> ManifestTask;
+
+struct Manifest
+{
+    std::vector<ManifestDistribution> distributions;
+    std::vector<ManifestTask> tasks;
+
+    int FindDistribution(const std::string& name) const
+    {
+        for (size_t i = 0; i < distributions.size(); ++i)
+        {
+            if (distributions[i].name == name)
+                return int(i);
+        }
+        return -1;
+    }
+
+    // The index of the interpolation task that writes fileName, or -1
+    int FindOutputFile(const std::string& fileName) const
+    {
+        for (size_t i = 0; i < tasks.size(); ++i)
+        {
+            const ManifestInterpolationTask* task = std::get_if<ManifestInterpolationTask>(&tasks[i]);
+            if (task && task->fileName == fileName)
+                return int(i);
+        }
+        return -1;
+    }
+};
+
+// The tokens of a line, split on whitespace, up to any #
+inline std::vector<std::string> TokenizeManifestLine(const std::string& line)
+{
+    std::vector<std::string> ret;
+    size_t i = 0;
+    while (i < line.size() && line[i] != '#')
+    {
+        if (line[i] == ' ' || line[i] == '\t' || line[i] == '\r')
+        {
+            i++;
+            continue;
+        }
+
+        size_t begin = i;
+        while (i < line.size() && line[i] != ' ' && line[i] != '\t' && line[i] != '\r' && line[i] != '#')
+            i++;
+        ret.push_back(line.substr(begin, i - begin));
+    }
+    return ret;
+}
+
+// Parses all of text as a number
+template <typename T>
+bool ParseManifestNumber(const std::string& text, T& value)
+{
+    const char* end = text.data() + text.size();
+    std::from_chars_result result = std::from_chars(text.data(), end, value);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+// Reads the manifest. Errors are printed, with the line they are on, and make it return false.
+inline bool ParseManifest(const char* fileName, Manifest& manifest)
+{
+    FILE* file = nullptr;
+    fopen_s(&file, fileName, "rb");
+    if (!file)
+    {
+        printf("Could not open manifest %s\n", fileName);
+        return false;
+    }
+
+    std::string text;
+    char buffer[65536];
+    size_t bytesRead = 0;
+    while ((bytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        text.append(buffer, bytesRead);
+    fclose(file);
+
+    bool success = true;
+    int lineNumber = 0;
+    size_t lineBegin = 0;
+    while (lineBegin < text.size())
+    {
+        size_t lineEnd = text.find('\n', lineBegin);
+        if (lineEnd == std::string::npos)
+            lineEnd = text.size();
+        std::vector<std::string> tokens = TokenizeManifestLine(text.substr(lineBegin, lineEnd - lineBegin));
+        lineBegin = lineEnd + 1;
+        lineNumber++;
+
+        if (tokens.empty())
+            continue;
+
+        auto error = [&](const char* message, const std::string& token)
+        {
+            printf("%s(%i): %s %s\n", fileName, lineNumber, message, token.c_str());
+            success = false;
+        };
+
+        auto findDistribution = [&](const std::string& name)
+        {
+            int ret = manifest.FindDistribution(name);
+            if (ret < 0)
+                error("Unknown distribution", name);
+            return ret;
+        };
+
+        // The numbers after the first few tokens
+        auto parseParameters = [&](size_t first, std::vector<float>& parameters)
+        {
+            for (size_t i = first; i < tokens.size(); ++i)
+            {
+                float value = 0.0f;
+                if (!ParseManifestNumber(tokens[i], value))
+                    error("Expected a number, got", tokens[i]);
+                parameters.push_back(value);
+            }
+        };
+
+        // key=value options after the first few tokens
+        auto forEachOption = [&](size_t first, const auto& fn)
+        {
+            for (size_t i = first; i < tokens.size(); ++i)
+            {
+                size_t equals = tokens[i].find('=');
+                if (equals == std::string::npos || !fn(tokens[i].substr(0, equals), tokens[i].substr(equals + 1)))
+                    error("Unknown option", tokens[i]);
+            }
+        };
+
+        const std::string& command = tokens[0];
+        if (command == "distribution")
+        {
+            if (tokens.size() < 3)
+            {
+                error("Expected distribution <name> <type>, got", command);
+                continue;
+            }
+
+            ManifestDistribution distribution;
+            distribution.name = tokens[1];
+            const std::string& type = tokens[2];
+            parseParameters(3, distribution.parameters);
+
+            size_t numParameters = 0;
+            if (type == "uniform")
+                distribution.type = ManifestDistributionType::Uniform;
+            else if (type == "linear")
+                distribution.type = ManifestDistributionType::Linear;
+            else if (type == "quadratic")
+                distribution.type = ManifestDistributionType::Quadratic;
+            else if (type == "gauss")
+            {
+                distribution.type = ManifestDistributionType::Gauss;
+                numParameters = 2;
+            }
+            else if (type == "polynomial")
+            {
+                distribution.type = ManifestDistributionType::Polynomial;
+                numParameters = std::max<size_t>(distribution.parameters.size(), 1);
+            }
+            else
+            {
+                error("Unknown distribution type", type);
+                continue;
+            }
+
+            if (distribution.parameters.size() != numParameters)
+                error("Wrong number of parameters for", type);
+            else if (distribution.type == ManifestDistributionType::Gauss && !(distribution.parameters[1] > 0.0f))
+                error("sigma needs to be > 0 for", distribution.name);
+            else if (distribution.IsTable() && !distribution.HasMass())
+                error("Density is zero everywhere on [0,1] for", distribution.name);
+
+            if (manifest.FindDistribution(distribution.name) >= 0)
+                error("Distribution defined twice:", distribution.name);
+            manifest.distributions.push_back(distribution);
+        }
+        else if (command == "distance")
+        {
+            if (tokens.size() < 3)
+            {
+                error("Expected distance <name1> <name2>, got", command);
+                continue;
+            }
+
+            ManifestDistanceTask task;
+            task.distribution1 = findDistribution(tokens[1]);
+            task.distribution2 = findDistribution(tokens[2]);
+            forEachOption(3,
+                [&](const std::string& key, const std::string& value)
+                {
+                    if (key == "p")
+                        return ParseManifestNumber(value, task.p) && task.p >= 1.0f;
+                    if (key == "samples")
+                        return ParseManifestNumber(value, task.numSamples) && task.numSamples > 0;
+                    if (key == "method" && value == "sampled")
+                        task.method = ManifestDistanceMethod::Sampled;
+                    else if (key == "method" && value == "quadrature")
+                        task.method = ManifestDistanceMethod::Quadrature;
+                    else if (key == "method" && value == "exact")
+                        task.method = ManifestDistanceMethod::Exact;
+                    else
+                        return false;
+                    return true;
+                }
+            );
+            manifest.tasks.push_back(task);
+        }
+        else if (command == "interpolate")
+        {
+            if (tokens.size() < 4)
+            {
+                error("Expected interpolate <name1> <name2> <file>, got", command);
+                continue;
+            }
+
+            ManifestInterpolationTask task;
+            task.distribution1 = findDistribution(tokens[1]);
+            task.distribution2 = findDistribution(tokens[2]);
+            task.fileName = tokens[3];
+
+            // Tasks run in parallel, so two of them can't write the same file
+            if (manifest.FindOutputFile(task.fileName) >= 0)
+                error("Output file written twice:", task.fileName);
+            forEachOption(4,
+                [&](const std::string& key, const std::string& value)
+                {
+                    if (key == "steps")
+                        return ParseManifestNumber(value, task.numSteps) && task.numSteps >= 2;
+                    if (key == "mode" && (value == "icdf" || value == "pdf"))
+                    {
+                        task.interpolateICDF = (value == "icdf");
+                        return true;
+                    }
+                    return false;
+                }
+            );
+            manifest.tasks.push_back(task);
+        }
+        else
+        {
+            error("Unknown command", command);
+        }
+    }
+    return success;
+}
+
+// A distribution of a manifest, ready to use
+typedef std::variant<PDFUniform, PDFLinear, PDFQuadratic, PDFTableCache::View> ManifestPDF;
+
+inline ManifestPDF MakeManifestPDF(const ManifestDistribution& distribution, PDFTableCache& tables)
+{
+    switch (distribution.type)
+    {
+        case ManifestDistributionType::Uniform: return PDFUniform();
+        case ManifestDistributionType::Linear: return PDFLinear();
+        case ManifestDistributionType::Quadratic: return PDFQuadratic();
+        default: return tables.Get(distribution.TableIdentifier().c_str(), distribution);
+    }
+}
+
+// Returns the line to print for the task
+template <typename PDF1, typename PDF2>
+std::string RunManifestTask(const Manifest& manifest, const ManifestDistanceTask& task, const PDF1& pdf1, const PDF2& pdf2)
+{
+    static const char* c_methodNames[] = { "sampled", "quadrature", "exact" };
+
+    // The method that was actually used
+    ManifestDistanceMethod method = task.method;
+
+    WassersteinEstimate estimate;
+    if (task.method == ManifestDistanceMethod::Sampled)
+    {
+        estimate.distance = PWassersteinDistance(task.p, pdf1, pdf2, task.numSamples);
+        estimate.numEvaluations = task.numSamples;
+    }
+    else if (task.method == ManifestDistanceMethod::Quadrature)
+    {
+        estimate = PWassersteinDistanceQuadrature(task.p, pdf1, pdf2);
+    }
+    else if constexpr (std::is_same_v<PDF1, PDFTableCache::View> && std::is_same_v<PDF2, PDFTableCache::View>)
+    {
+        estimate = PWassersteinDistanceExact(task.p, GetICDFKnots(pdf1), GetICDFKnots(pdf2));
+    }
+    else if constexpr (std::is_same_v<PDF1, PDFTableCache::View>)
+    {
+        estimate = PWassersteinDistanceExact(task.p, GetICDFKnots(pdf1), pdf2);
+    }
+    else if constexpr (std::is_same_v<PDF2, PDFTableCache::View>)
+    {
+        estimate = PWassersteinDistanceExact(task.p, GetICDFKnots(pdf2), pdf1);
+    }
+    else
+    {
+        // Both are analytic, which have no knots, so exact is quadrature
+        method = ManifestDistanceMethod::Quadrature;
+        estimate = PWassersteinDistanceQuadrature(task.p, pdf1, pdf2);
+    }
+
+    char line[1024];
+    int length = sprintf_s(line, "(manifest %s p=%g) %s To %s = %f", c_methodNames[int(method)], task.p,
+        manifest.distributions[task.distribution1].name.c_str(), manifest.distributions[task.distribution2].name.c_str(), estimate.distance);
+    std::string ret(line, std::clamp(length, 0, int(sizeof(line)) - 1));
+
+    // Sampling doesn't estimate its error
+    if (task.method == ManifestDistanceMethod::Sampled)
+        sprintf_s(line, " (%i samples)", estimate.numEvaluations);
+    else
+        sprintf_s(line, " +/- %f (%i evaluations)", estimate.errorBound, estimate.numEvaluations);
+    return ret + line;
+}
+
+template <typename PDF1, typename PDF2>
+std::string RunManifestTask(const Manifest& manifest, const ManifestInterpolationTask& task, const PDF1& pdf1, const PDF2& pdf2)
+{
+    if (task.interpolateICDF)
+        OutputWriter::Get().Write(task.fileName.c_str(), MakeInterpolationTable_ICDF(pdf1, pdf2, task.numSteps));
+    else
+        OutputWriter::Get().Write(task.fileName.c_str(), MakeInterpolationTable_PDF(pdf1, pdf2, task.numSteps));
+
+    return "(manifest " + std::string(task.interpolateICDF ? "icdf" : "pdf") + " interpolation) " +
+        manifest.distributions[task.distribution1].name + " To " + manifest.distributions[task.distribution2].name + " -> " + task.fileName;
+}
+
+// Runs every task of the manifest. tablesFileName is an optional PDFTableCache file. Returns the exit code for main.
+inline int RunManifest(const char* fileName, const char* tablesFileName = nullptr)
+{
+    Manifest manifest;
+    if (!ParseManifest(fileName, manifest))
+        return 1;
+
+    std::vector<std::string> results(manifest.tasks.size());
+    std::string newTablesFileName = tablesFileName ? std::string(tablesFileName) + ".new" : std::string();
+    bool writeTables = false;
+    {
+        PDFTableCache tables(tablesFileName ? tablesFileName : "");
+
+        // Build each table once, up front, so tasks that share a table don't wait on each other to build it
+        std::vector<ManifestPDF> pdfs(manifest.distributions.size());
+        ParallelFor(int(pdfs.size()),
+            [&](int index)
+            {
+                pdfs[index] = MakeManifestPDF(manifest.distributions[index], tables);
+            }
+        );
+
+        ParallelFor(int(manifest.tasks.size()),
+            [&](int index)
+            {
+                results[index] = std::visit(
+                    [&](const auto& task)
+                    {
+                        return std::visit(
+                            [&](const auto& pdf1, const auto& pdf2)
+                            {
+                                return RunManifestTask(manifest, task, pdf1, pdf2);
+                            },
+                            pdfs[task.distribution1], pdfs[task.distribution2]
+                        );
+                    },
+                    manifest.tasks[index]
+                );
+            }
+        );
+
+        // The cache's file is mapped until the cache is destroyed, and can't be replaced until then on Windows
+        if (tablesFileName && tables.NumBuilt() > 0)
+            writeTables = tables.Write(newTablesFileName.c_str());
+    }
+
+    for (const std::string& result : results)
+        printf("%s\n", result.c_str());
+
+    OutputWriter::Get().Flush();
+
+    if (writeTables && !RenameReplacing(newTablesFileName.c_str(), tablesFileName))
+    {
+        printf("Could not write table cache %s\n", tablesFileName);
+        remove(newTablesFileName.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+
+#include "parallel.h"
+#include "utils.h"
+#include "distancematrix.h"
+
+// Nearest neighbor queries over a corpus of distributions, by 2-Wasserstein distance.
+// In 1D, W_2 is the L2 distance between the ICDFs, so each distribution is stored as its row of a QuantileMatrix
+// (its ICDF at the midpoints of M quantile cells), and W_2 = sqrt(average of (row1 - row2)^2), which is a metric.
+//
+// Two ways to search:
+//   The scan compares a query against every row, using DotProduct: |a-b|^2 = a.a + b.b - 2 a.b, with the
+//   squared lengths of the rows computed once. Batches of queries are compared against blocks of rows, like
+//   PWassersteinDistanceMatrix, so a block of rows is read from memory once per batch instead of once per query.
+//   A vantage point tree, which is built when the index is made, skips whole subtrees using the triangle inequality.
+//   Each node splits its rows into those within the median distance of a vantage row, and those further away.
+//   It uses SumSquaredDifference, since the pruning needs distances to be accurate when they are small.
+//
+// Queries are rows of a QuantileMatrix from MakeQueries, since the distance functions load whole aligned,
+// padded rows with AVX2. A query matrix on a different quantile grid gets empty results.
+// Batch queries run in parallel over the queries. Results are sorted by distance, then by row.
+
+struct W2Neighbor
+{
+    int index;
+    float distance;
+
+    bool operator < (const W2Neighbor& other) const
+    {
+        return (distance != other.distance) ? (distance < other.distance) : (index < other.index);
+    }
+};
+
+struct W2NearestNeighborIndex
+{
+    static const int c_leafSize = 16;
+    static const int c_queryTileSize = 16;
+    static const int c_rowTileSize = 64;
+
+    explicit W2NearestNeighborIndex(QuantileMatrix&& rows)
+        : m_rows(std::move(rows))
+    {
+        m_squaredLengths.resize(m_rows.m_numRows);
+        ParallelFor(m_rows.m_numRows,
+            [&](int row)
+            {
+                m_squaredLengths[row] = DotProduct(m_rows.Row(row), m_rows.Row(row), m_rows.m_stride);
+            }
+        );
+        BuildTree();
+    }
+
+    template <typename PDF>
+    static W2NearestNeighborIndex FromPDFs(const std::vector<PDF>& pdfs, int numQuantiles = 1024)
+    {
+        return W2NearestNeighborIndex(QuantileMatrix::FromPDFs(pdfs, numQuantiles));
+    }
+
+    // Queries need to be on the same quantile grid as the index
+    template <typename PDF>
+    QuantileMatrix MakeQueries(const std::vector<PDF>& pdfs) const
+    {
+        return QuantileMatrix::FromPDFs(pdfs, m_rows.m_numQuantiles);
+    }
+
+    int NumRows() const
+    {
+        return m_rows.m_numRows;
+    }
+
+    // W_2 between a query and a row of the index, or NaN if the query is on a different quantile grid
+    float Distance(const QuantileMatrix& queries, int query, int row) const
+    {
+        if (!IsOnGrid(queries))
+            return std::numeric_limits<float>::quiet_NaN();
+        return Distance(queries.Row(query), row);
+    }
+
+    // The k nearest rows, using the tree
+    std::vector<W2Neighbor> KNearest(const QuantileMatrix& queries, int query, int k) const
+    {
+        if (!IsOnGrid(queries))
+            return {};
+        return KNearest(queries.Row(query), k);
+    }
+
+    // Every row within radius, using the tree
+    std::vector<W2Neighbor> WithinRadius(const QuantileMatrix& queries, int query, float radius) const
+    {
+        if (!IsOnGrid(queries))
+            return {};
+        return WithinRadius(queries.Row(query), radius);
+    }
+
+    // The k nearest rows, comparing against every row
+    std::vector<W2Neighbor> KNearestScan(const QuantileMatrix& queries, int query, int k) const
+    {
+        if (!IsOnGrid(queries))
+            return {};
+        return KNearestScan(queries.Row(query), k);
+    }
+
+    std::vector<std::vector<W2Neighbor>> KNearest(const QuantileMatrix& queries, int k) const
+    {
+        std::vector<std::vector<W2Neighbor>> ret(queries.m_numRows);
+        if (!IsOnGrid(queries))
+            return ret;
+        ParallelFor(queries.m_numRows,
+            [&](int query)
+            {
+                ret[query] = KNearest(queries.Row(query), k);
+            }
+        );
+        return ret;
+    }
+
+    std::vector<std::vector<W2Neighbor>> WithinRadius(const QuantileMatrix& queries, float radius) const
+    {
+        std::vector<std::vector<W2Neighbor>> ret(queries.m_numRows);
+        if (!IsOnGrid(queries))
+            return ret;
+        ParallelFor(queries.m_numRows,
+            [&](int query)
+            {
+                ret[query] = WithinRadius(queries.Row(query), radius);
+            }
+        );
+        return ret;
+    }
+
+    // The k nearest rows of each query by the blocked scan. Each tile of queries is compared against tiles of rows.
+    std::vector<std::vector<W2Neighbor>> KNearestScan(const QuantileMatrix& queries, int k) const
+    {
+        int numQueries = queries.m_numRows;
+        int numQueryTiles = (numQueries + c_queryTileSize - 1) / c_queryTileSize;
+        std::vector<std::vector<W2Neighbor>> ret(numQueries);
+        if (!IsOnGrid(queries))
+            return ret;
+        ParallelFor(numQueryTiles,
+            [&](int queryTile)
+            {
+                int beginQuery = queryTile * c_queryTileSize;
+                int endQuery = std::min(beginQuery + c_queryTileSize, numQueries);
+
+                std::vector<NeighborList> neighbors(endQuery - beginQuery, NeighborList(k));
+                double querySquaredLengths[c_queryTileSize];
+                for (int query = beginQuery; query < endQuery; ++query)
+                    querySquaredLengths[query - beginQuery] = DotProduct(queries.Row(query), queries.Row(query), queries.m_stride);
+
+                for (int beginRow = 0; beginRow < NumRows(); beginRow += c_rowTileSize)
+                {
+                    int endRow = std::min(beginRow + c_rowTileSize, NumRows());
+                    for (int query = beginQuery; query < endQuery; ++query)
+                    {
+                        const float* queryRow = queries.Row(query);
+                        for (int row = beginRow; row < endRow; ++row)
+                        {
+                            double squaredDistance = querySquaredLengths[query - beginQuery] + m_squaredLengths[row] - 2.0 * DotProduct(queryRow, m_rows.Row(row), m_rows.m_stride);
+                            neighbors[query - beginQuery].Add(row, ToDistance(squaredDistance));
+                        }
+                    }
+                }
+
+                for (int query = beginQuery; query < endQuery; ++query)
+                    ret[query] = neighbors[query - beginQuery].Sorted();
+            }
+        );
+        return ret;
+    }
+
+private:
+    // Either the k nearest so far, as a max heap, or everything within a fixed radius
+    struct NeighborList
+    {
+        explicit NeighborList(int k)
+            : m_k(std::max(k, 0))
+        {
+        }
+
+        explicit NeighborList(float radius)
+            : m_isRadius(true)
+            , m_radius(radius)
+        {
+        }
+
+        // Anything further than this can't be added
+        float Radius() const
+        {
+            if (m_isRadius)
+                return m_radius;
+            if (m_k == 0)
+                return -1.0f;
+            return (int(m_neighbors.size()) < m_k) ? std::numeric_limits<float>::infinity() : m_neighbors.front().distance;
+        }
+
+        void Add(int index, float distance)
+        {
+            W2Neighbor neighbor = { index, distance };
+            if (m_isRadius)
+            {
+                if (distance <= m_radius)
+                    m_neighbors.push_back(neighbor);
+            }
+            else if (int(m_neighbors.size()) < m_k)
+            {
+                m_neighbors.push_back(neighbor);
+                std::push_heap(m_neighbors.begin(), m_neighbors.end());
+            }
+            else if (m_k > 0 && neighbor < m_neighbors.front())
+            {
+                std::pop_heap(m_neighbors.begin(), m_neighbors.end());
+                m_neighbors.back() = neighbor;
+                std::push_heap(m_neighbors.begin(), m_neighbors.end());
+            }
+        }
+
+        std::vector<W2Neighbor> Sorted()
+        {
+            std::sort(m_neighbors.begin(), m_neighbors.end());
+            return std::move(m_neighbors);
+        }
+
+        int m_k = 0;
+        bool m_isRadius = false;
+        float m_radius = 0.0f;
+        std::vector<W2Neighbor> m_neighbors;
+    };
+
+    // Rows m_order[begin, end). Leaves have no children, and their rows are all scanned.
+    // Otherwise m_order[begin] is the vantage row, the next (end - begin - 1) / 2 rows are within radius of it,
+    // and the rest are at least radius away.
+    struct TreeNode
+    {
+        int begin;
+        int end;
+        float radius;
+        int inside = -1;
+        int outside = -1;
+    };
+
+    // The public functions above on a single query, which is a row of a QuantileMatrix on the same grid as m_rows
+    float Distance(const float* query, int row) const
+    {
+        return ToDistance(SumSquaredDifference(query, m_rows.Row(row), m_rows.m_stride));
+    }
+
+    std::vector<W2Neighbor> KNearest(const float* query, int k) const
+    {
+        NeighborList neighbors(k);
+        if (k > 0 && NumRows() > 0)
+            SearchTree(query, 0, neighbors);
+        return neighbors.Sorted();
+    }
+
+    std::vector<W2Neighbor> WithinRadius(const float* query, float radius) const
+    {
+        NeighborList neighbors(radius);
+        if (NumRows() > 0)
+            SearchTree(query, 0, neighbors);
+        return neighbors.Sorted();
+    }
+
+    std::vector<W2Neighbor> KNearestScan(const float* query, int k) const
+    {
+        NeighborList neighbors(k);
+        double querySquaredLength = DotProduct(query, query, m_rows.m_stride);
+        for (int row = 0; row < NumRows(); ++row)
+            neighbors.Add(row, ToDistance(querySquaredLength + m_squaredLengths[row] - 2.0 * DotProduct(query, m_rows.Row(row), m_rows.m_stride)));
+        return neighbors.Sorted();
+    }
+
+    bool IsOnGrid(const QuantileMatrix& queries) const
+    {
+        return queries.m_numQuantiles == m_rows.m_numQuantiles && queries.m_stride == m_rows.m_stride;
+    }
+
+    float ToDistance(double squaredDistance) const
+    {
+        return float(std::sqrt(std::max(squaredDistance, 0.0) / double(m_rows.m_numQuantiles)));
+    }
+
+    void BuildTree()
+    {
+        m_order.resize(NumRows());
+        for (int row = 0; row < NumRows(); ++row)
+            m_order[row] = row;
+
+        m_tree.clear();
+        m_tree.reserve(2 * size_t(NumRows() / c_leafSize + 1));
+        if (NumRows() > 0)
+            BuildNode(0, NumRows());
+    }
+
+    int BuildNode(int begin, int end)
+    {
+        int nodeIndex = int(m_tree.size());
+        m_tree.push_back({ begin, end, 0.0f });
+        if (end - begin <= c_leafSize)
+            return nodeIndex;
+
+        // The vantage row is picked the same way every time, so the tree is too
+        pcg32_random_t rng = GetRNG(uint64_t(begin), uint64_t(end));
+        int vantage = begin + int(pcg32_boundedrand_r(&rng, uint32_t(end - begin)));
+        std::swap(m_order[begin], m_order[vantage]);
+
+        // Split the rest at the median distance from the vantage row
+        std::vector<std::pair<float, int>> distances(end - begin - 1);
+        const float* vantageRow = m_rows.Row(m_order[begin]);
+        ParallelFor(int(distances.size()),
+            [&](int i)
+            {
+                int row = m_order[begin + 1 + i];
+                distances[i] = { Distance(vantageRow, row), row };
+            }
+        );
+
+        size_t median = (distances.size() - 1) / 2;
+        std::nth_element(distances.begin(), distances.begin() + median, distances.end());
+        for (size_t i = 0; i < distances.size(); ++i)
+            m_order[begin + 1 + i] = distances[i].second;
+
+        int middle = begin + 1 + int(median) + 1;
+        m_tree[nodeIndex].radius = distances[median].first;
+        int inside = BuildNode(begin + 1, middle);
+        int outside = BuildNode(middle, end);
+        m_tree[nodeIndex].inside = inside;
+        m_tree[nodeIndex].outside = outside;
+        return nodeIndex;
+    }
+
+    void SearchTree(const float* query, int nodeIndex, NeighborList& neighbors) const
+    {
+        const TreeNode& node = m_tree[nodeIndex];
+        if (node.inside < 0)
+        {
+            for (int i = node.begin; i < node.end; ++i)
+                neighbors.Add(m_order[i], Distance(query, m_order[i]));
+            return;
+        }
+
+        float distance = Distance(query, m_order[node.begin]);
+        neighbors.Add(m_order[node.begin], distance);
+
+        // Search the side the query is on first, since it's more likely to shrink the radius.
+        // Rows inside are within node.radius of the vantage row, so they are at least distance - node.radius from the query.
+        // Rows outside are at least node.radius away, so they are at least node.radius - distance from the query.
+        if (distance <= node.radius)
+        {
+            SearchTree(query, node.inside, neighbors);
+            if (node.radius - distance <= neighbors.Radius())
+                SearchTree(query, node.outside, neighbors);
+        }
+        else
+        {
+            SearchTree(query, node.outside, neighbors);
+            if (distance - node.radius <= neighbors.Radius())
+                SearchTree(query, node.inside, neighbors);
+        }
+    }
+
+    QuantileMatrix m_rows;
+    std::vector<double> m_squaredLengths;
+    std::vector<int> m_order;
+    std::vector<TreeNode> m_tree;
+};
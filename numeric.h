@@ -1,24 +1,228 @@
 #pragma once
 
-#include <vector>
+#include <array>
+#include <algorithm>
 #include <functional>
 
-struct PDFNumeric
+#include "simd.h"
+#include "instrumentation.h"
+
+// The CDF and ICDF of a PDFNumericT, working on tables that are stored somewhere else.
+// PDFNumericT uses this on its own tables, and it can also be used on tables that were loaded or memory mapped,
+// without copying them. There is no density function, so PDF comes from the slope of the CDF table.
+template <int TCDFSamples = 100>
+struct PDFNumericViewT
 {
-    static const float inline c_xmin = 0.0f;
-    static const float inline c_xmax = 1.0f;
+    static constexpr float c_xmin = 0.0f;
+    static constexpr float c_xmax = 1.0f;
+
+    static const int c_CDFSamples = TCDFSamples;
+    static const int c_ICDFGuideSamples = 4 * c_CDFSamples;
+
+    // The number of values in m_ICDFGuide
+    static const int c_ICDFGuideSize = c_ICDFGuideSamples + 2;
+
+    float PDF(float x) const
+    {
+        INSTRUMENT_COUNT(PDFCalls, 1);
+        if (x < c_xmin || x > c_xmax)
+            return 0.0f;
+
+        int index = Clamp(int(x * float(c_CDFSamples)), 0, c_CDFSamples - 1);
+        float lowerValue = (index > 0) ? m_CDFTable[index - 1] : 0.0f;
+        return (m_CDFTable[index] - lowerValue) * float(c_CDFSamples);
+    }
+
+    float CDF(float x) const
+    {
+        INSTRUMENT_COUNT(CDFCalls, 1);
+        if (x < c_xmin)
+            return 0.0f;
+
+        if (x > c_xmax)
+            return 1.0f;
 
-    static const int c_PDFSamples = 10000;
-    static const int c_CDFSamples = 100;
+        float index = Clamp(x * float(c_CDFSamples), 0.0f, float(c_CDFSamples - 1));
 
-    typedef std::function<float(float)> PDFFn;
+        int index1 = int(index);
+        int index2 = Clamp(index1 + 1, 0, c_CDFSamples - 1);
+        float fract = index - floor(index);
+        return Lerp(m_CDFTable[index1], m_CDFTable[index2], fract);
+    }
 
-    PDFNumeric(PDFFn pdf)
+    float ICDF(float x) const
     {
-        m_PDF = pdf;
+        INSTRUMENT_COUNT(ICDFCalls, 1);
+        if (x < c_xmin)
+            return 0.0f;
+
+        if (x > c_xmax)
+            return 1.0f;
+
+        // Only search the part of the CDF table that the guide table says the answer is in.
+        // This gives the exact same result as searching the whole table.
+        int guideIndex = GuideIndex(x);
+        const float* begin = m_CDFTable + m_ICDFGuide[guideIndex];
+        const float* end = m_CDFTable + m_ICDFGuide[guideIndex + 1];
+        INSTRUMENT_LOWER_BOUND(end - begin);
+        const float* it = std::lower_bound(begin, end, x);
+        if (it == m_CDFTable + c_CDFSamples)
+            return 1.0f;
+
+        return ICDFFromUpperIndex(x, int(it - m_CDFTable));
+    }
+
+    // ICDF by binary searching the whole CDF table, without using the guide table
+    float ICDFBinarySearch(float x) const
+    {
+        INSTRUMENT_COUNT(ICDFCalls, 1);
+        INSTRUMENT_LOWER_BOUND(c_CDFSamples);
+        if (x < c_xmin)
+            return 0.0f;
+
+        if (x > c_xmax)
+            return 1.0f;
+
+        const float* it = std::lower_bound(m_CDFTable, m_CDFTable + c_CDFSamples, x);
+        if (it == m_CDFTable + c_CDFSamples)
+            return 1.0f;
+
+        return ICDFFromUpperIndex(x, int(it - m_CDFTable));
+    }
+
+    // upperIndex is the index of the first CDF table value >= x
+    float ICDFFromUpperIndex(float x, int upperIndex) const
+    {
+        int lowerIndex = std::max(upperIndex - 1, 0);
+
+        if (lowerIndex == upperIndex)
+            return float(lowerIndex) / float(c_CDFSamples);
+
+        float lowerValue = m_CDFTable[lowerIndex];
+        float upperValue = m_CDFTable[upperIndex];
+
+        float fraction = (x - lowerValue) / (upperValue - lowerValue);
+
+        return (float(lowerIndex) + fraction) / float(c_CDFSamples);
+    }
+
+    void PDF(const float* x, float* out, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = PDF(x[i]);
+    }
+
+    void CDF(const float* x, float* out, size_t count) const
+    {
+        size_t i = 0;
+#if SIMD_AVX2()
+        const __m256i lastIndex = _mm256_set1_epi32(c_CDFSamples - 1);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 v = _mm256_loadu_ps(x + i);
+            __m256 index = SIMDClamp(_mm256_mul_ps(v, _mm256_set1_ps(float(c_CDFSamples))), 0.0f, float(c_CDFSamples - 1));
+
+            __m256i index1 = _mm256_cvttps_epi32(index);
+            __m256i index2 = _mm256_min_epi32(_mm256_add_epi32(index1, _mm256_set1_epi32(1)), lastIndex);
+            __m256 fract = _mm256_sub_ps(index, _mm256_floor_ps(index));
+            __m256 result = SIMDLerp(_mm256_i32gather_ps(m_CDFTable, index1, 4), _mm256_i32gather_ps(m_CDFTable, index2, 4), fract);
+
+            // 0 below the range, 1 above it
+            result = _mm256_and_ps(result, _mm256_cmp_ps(v, _mm256_set1_ps(c_xmin), _CMP_GE_OQ));
+            result = _mm256_blendv_ps(result, _mm256_set1_ps(1.0f), _mm256_cmp_ps(v, _mm256_set1_ps(c_xmax), _CMP_GT_OQ));
+            _mm256_storeu_ps(out + i, result);
+        }
+#endif
+        INSTRUMENT_COUNT(CDFCalls, i);
+        for (; i < count; ++i)
+            out[i] = CDF(x[i]);
+    }
+
+    // Does the same lower bound search as the scalar ICDF in every lane, so gives identical results
+    void ICDF(const float* x, float* out, size_t count) const
+    {
+        size_t i = 0;
+#if SIMD_AVX2()
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i one = _mm256_set1_epi32(1);
+        const __m256i tableSize = _mm256_set1_epi32(c_CDFSamples);
+        const __m256i lastIndex = _mm256_set1_epi32(c_CDFSamples - 1);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 v = _mm256_loadu_ps(x + i);
+            __m256 clamped = SIMDClamp(v, c_xmin, c_xmax);
+
+            // The search range from the guide table
+            __m256i guideIndex = _mm256_cvttps_epi32(_mm256_mul_ps(clamped, _mm256_set1_ps(float(c_ICDFGuideSamples))));
+            guideIndex = _mm256_min_epi32(_mm256_max_epi32(guideIndex, zero), _mm256_set1_epi32(c_ICDFGuideSamples));
+            __m256i begin = _mm256_i32gather_epi32(m_ICDFGuide, guideIndex, 4);
+            __m256i length = _mm256_sub_epi32(_mm256_i32gather_epi32(m_ICDFGuide, _mm256_add_epi32(guideIndex, one), 4), begin);
+
+            // Branchless std::lower_bound, run until every lane has an empty range
+            INSTRUMENT_COUNT(LowerBoundSearches, 8);
+            while (!_mm256_testz_si256(_mm256_cmpgt_epi32(length, zero), _mm256_cmpgt_epi32(length, zero)))
+            {
+                INSTRUMENT_COUNT(LowerBoundProbes, InstrumentationPopCount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(length, zero)))));
+                __m256i half = _mm256_srli_epi32(length, 1);
+                __m256i middle = _mm256_add_epi32(begin, half);
+                __m256 value = _mm256_i32gather_ps(m_CDFTable, _mm256_min_epi32(middle, lastIndex), 4);
+                __m256i less = _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(value, clamped, _CMP_LT_OQ)), _mm256_cmpgt_epi32(length, zero));
+                begin = _mm256_blendv_epi8(begin, _mm256_add_epi32(middle, one), less);
+                length = _mm256_blendv_epi8(half, _mm256_sub_epi32(_mm256_sub_epi32(length, half), one), less);
+            }
+
+            // ICDFFromUpperIndex
+            __m256i upperIndex = _mm256_min_epi32(begin, lastIndex);
+            __m256i lowerIndex = _mm256_max_epi32(_mm256_sub_epi32(upperIndex, one), zero);
+            __m256 lowerValue = _mm256_i32gather_ps(m_CDFTable, lowerIndex, 4);
+            __m256 upperValue = _mm256_i32gather_ps(m_CDFTable, upperIndex, 4);
+            __m256 fraction = _mm256_div_ps(_mm256_sub_ps(clamped, lowerValue), _mm256_sub_ps(upperValue, lowerValue));
+            fraction = _mm256_and_ps(fraction, _mm256_castsi256_ps(_mm256_cmpgt_epi32(upperIndex, lowerIndex)));
+            __m256 result = _mm256_div_ps(_mm256_add_ps(_mm256_cvtepi32_ps(lowerIndex), fraction), _mm256_set1_ps(float(c_CDFSamples)));
+
+            // 1 if the search went off the end of the table, or if above the range. 0 if below the range.
+            __m256 useOne = _mm256_or_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(begin, tableSize)), _mm256_cmp_ps(v, _mm256_set1_ps(c_xmax), _CMP_GT_OQ));
+            result = _mm256_blendv_ps(result, _mm256_set1_ps(1.0f), useOne);
+            result = _mm256_and_ps(result, _mm256_cmp_ps(v, _mm256_set1_ps(c_xmin), _CMP_GE_OQ));
+            _mm256_storeu_ps(out + i, result);
+        }
+#endif
+        INSTRUMENT_COUNT(ICDFCalls, i);
+        for (; i < count; ++i)
+            out[i] = ICDF(x[i]);
+    }
+
+    static constexpr int GuideIndex(float x)
+    {
+        return Clamp(int(x * float(c_ICDFGuideSamples)), 0, c_ICDFGuideSamples);
+    }
+
+    const float* m_CDFTable = nullptr;    // c_CDFSamples values
+    const int* m_ICDFGuide = nullptr;     // c_ICDFGuideSize values
+};
+
+// A PDF described by a density function, with a CDF table made from it for CDF and ICDF queries.
+// The density callable and the table sizes are template parameters, so that the density can be
+// called directly instead of through a std::function, and so that the tables can be sized per use.
+// When the density can be evaluated at compile time, the whole thing can be made constexpr.
+template <typename TPDFFn, int TPDFSamples = 10000, int TCDFSamples = 100>
+struct PDFNumericT
+{
+    static constexpr float c_xmin = 0.0f;
+    static constexpr float c_xmax = 1.0f;
+
+    static const int c_PDFSamples = TPDFSamples;
+    static const int c_CDFSamples = TCDFSamples;
+    static const int c_ICDFGuideSamples = PDFNumericViewT<TCDFSamples>::c_ICDFGuideSamples;
+
+    typedef TPDFFn PDFFn;
+
+    constexpr PDFNumericT(const PDFFn& pdf)
+        : m_PDF(pdf)
+    {
+        INSTRUMENT_TIMER_BEGIN(buildStart);
 
         // Make a discretized PDF table
-        m_CDFTable.resize(c_CDFSamples, 0.0f);
         for (int pdfIndex = 0; pdfIndex < c_PDFSamples; ++pdfIndex)
         {
             float x = float(pdfIndex) / float(c_PDFSamples - 1);
@@ -40,10 +244,25 @@ struct PDFNumeric
         // normalize CDF so last value is 1.0
         for (float& f : m_CDFTable)
             f /= m_CDFTable[c_CDFSamples - 1];
+
+        // Make the ICDF guide table. Entry i is the first CDF index whose guide index is >= i.
+        // The lower bound of x in the CDF table is always between m_ICDFGuide[GuideIndex(x)] and
+        // m_ICDFGuide[GuideIndex(x) + 1], which is usually only zero to two entries apart.
+        int cdfIndex = 0;
+        for (int guideIndex = 0; guideIndex < c_ICDFGuideSamples + 2; ++guideIndex)
+        {
+            while (cdfIndex < c_CDFSamples && GuideIndex(m_CDFTable[cdfIndex]) < guideIndex)
+                cdfIndex++;
+            m_ICDFGuide[guideIndex] = cdfIndex;
+        }
+
+        INSTRUMENT_COUNT(TableBuilds, 1);
+        INSTRUMENT_TIMER_END(TableBuildNanoseconds, buildStart);
     }
 
-    float PDF(float x) const
+    constexpr float PDF(float x) const
     {
+        INSTRUMENT_COUNT(PDFCalls, 1);
         if (x < c_xmin || x > c_xmax)
             return 0.0f;
         return m_PDF(x);
@@ -51,46 +270,58 @@ struct PDFNumeric
 
     float CDF(float x) const
     {
-        if (x < c_xmin)
-            return 0.0f;
-
-        if (x > c_xmax)
-            return 1.0f;
-
-        float index = Clamp(x * float(c_CDFSamples), 0.0f, float(c_CDFSamples - 1));
-
-        int index1 = int(index);
-        int index2 = Clamp(index1 + 1, 0, c_CDFSamples - 1);
-        float fract = index - floor(index);
-        return Lerp(m_CDFTable[index1], m_CDFTable[index2], fract);
+        return View().CDF(x);
     }
 
     float ICDF(float x) const
     {
-        if (x < c_xmin)
-            return 0.0f;
-
-        if (x > c_xmax)
-            return 1.0f;
+        return View().ICDF(x);
+    }
 
-        auto it = std::lower_bound(m_CDFTable.begin(), m_CDFTable.end(), x);
-        if (it == m_CDFTable.end())
-            return 1.0f;
+    // ICDF by binary searching the whole CDF table, without using the guide table
+    float ICDFBinarySearch(float x) const
+    {
+        return View().ICDFBinarySearch(x);
+    }
 
-        int upperIndex = int(it - m_CDFTable.begin());
-        int lowerIndex = std::max(upperIndex - 1, 0);
+    void PDF(const float* x, float* out, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = PDF(x[i]);
+    }
 
-        if (lowerIndex == upperIndex)
-            return float(lowerIndex) / float(c_CDFSamples);
+    void CDF(const float* x, float* out, size_t count) const
+    {
+        View().CDF(x, out, count);
+    }
 
-        float lowerValue = m_CDFTable[lowerIndex];
-        float upperValue = m_CDFTable[upperIndex];
+    void ICDF(const float* x, float* out, size_t count) const
+    {
+        View().ICDF(x, out, count);
+    }
 
-        float fraction = (x - lowerValue) / (upperValue - lowerValue);
+    static constexpr int GuideIndex(float x)
+    {
+        return PDFNumericViewT<TCDFSamples>::GuideIndex(x);
+    }
 
-        return (float(lowerIndex) + fraction) / float(c_CDFSamples);
+    PDFNumericViewT<TCDFSamples> View() const
+    {
+        return { m_CDFTable.data(), m_ICDFGuide.data() };
     }
 
     PDFFn m_PDF;
-    std::vector<float> m_CDFTable;
-};
\ No newline at end of file
+    std::array<float, c_CDFSamples> m_CDFTable = {};
+    std::array<int, PDFNumericViewT<TCDFSamples>::c_ICDFGuideSize> m_ICDFGuide = {};
+};
+
+// The general purpose version, which takes any density function at the default table sizes
+typedef PDFNumericT<std::function<float(float)>> PDFNumeric;
+
+// Makes a PDFNumericT which calls the density directly, for example:
+// constexpr auto pdf = MakePDFNumeric<1000, 50>([](float x) { return 2.0f * x; });
+template <int TPDFSamples = 10000, int TCDFSamples = 100, typename TPDFFn>
+constexpr PDFNumericT<TPDFFn, TPDFSamples, TCDFSamples> MakePDFNumeric(const TPDFFn& pdf)
+{
+    return PDFNumericT<TPDFFn, TPDFSamples, TCDFSamples>(pdf);
+}
\ No newline at end of file
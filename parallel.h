@@ -0,0 +1,170 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <algorithm>
+
+// A fixed set of worker threads that are kept alive for the life of the program, so that
+// parallel loops don't pay for thread creation every time they are called.
+//
+// Any number of parallel loops can be running at once, including loops inside of other loops' iterations.
+// Each loop is a job that idle threads take indices from, newest job first, so the inner loops of a nested
+// loop get finished before more outer iterations are started. A thread waiting for its own loop to finish
+// helps with loops started after it, which includes the loops nested inside of its own, rather than sleeping.
+// It doesn't help with older loops, since those iterations could be long, and would hold up its return.
+struct ThreadPool
+{
+    typedef std::function<void(int)> JobFn;
+
+    static ThreadPool& Get()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    ThreadPool()
+    {
+        // The thread calling ParallelFor also does work, so it counts as one of the threads
+        int numWorkers = std::max(int(std::thread::hardware_concurrency()), 1) - 1;
+        for (int i = 0; i < numWorkers; ++i)
+            m_threads.emplace_back([this]() { WorkerLoop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_wake.notify_all();
+        for (std::thread& thread : m_threads)
+            thread.join();
+    }
+
+    int GetNumThreads() const
+    {
+        return int(m_threads.size()) + 1;
+    }
+
+    // Calls fn(index) for every index in [0, count), spread across the threads.
+    // Returns when every index has been processed.
+    void ParallelFor(int count, const JobFn& fn)
+    {
+        // Run serially if there is nothing to split up
+        if (count <= 1 || m_threads.empty())
+        {
+            for (int i = 0; i < count; ++i)
+                fn(i);
+            return;
+        }
+
+        std::shared_ptr<Job> job = std::make_shared<Job>();
+        job->fn = &fn;
+        job->count = count;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            job->id = ++m_lastJobId;
+            m_jobs.push_back(job);
+        }
+        m_wake.notify_all();
+
+        RunJob(*job);
+
+        // Help with newer jobs until the other threads finish their indices of this one
+        while (job->numDone.load() < count)
+        {
+            std::shared_ptr<Job> other;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [&]() { return job->numDone.load() >= count || (other = FindJob(job->id)) != nullptr; });
+            }
+            if (other)
+                RunJob(*other);
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.erase(std::find(m_jobs.begin(), m_jobs.end(), job));
+    }
+
+private:
+    struct Job
+    {
+        const JobFn* fn = nullptr;
+        int count = 0;
+        uint64_t id = 0;
+        std::atomic<int> nextIndex = 0;
+        std::atomic<int> numDone = 0;
+    };
+
+    // Runs indices of the job until they have all been taken
+    void RunJob(Job& job)
+    {
+        while (true)
+        {
+            int index = job.nextIndex.fetch_add(1);
+            if (index >= job.count)
+                break;
+            (*job.fn)(index);
+
+            // The last one done wakes up the thread waiting on the job
+            if (job.numDone.fetch_add(1) + 1 == job.count)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_wake.notify_all();
+            }
+        }
+    }
+
+    // The newest job started after minId that still has indices to take, or null. m_mutex must be locked.
+    std::shared_ptr<Job> FindJob(uint64_t minId) const
+    {
+        for (auto it = m_jobs.rbegin(); it != m_jobs.rend() && (*it)->id > minId; ++it)
+        {
+            if ((*it)->nextIndex.load() < (*it)->count)
+                return *it;
+        }
+        return nullptr;
+    }
+
+    void WorkerLoop()
+    {
+        while (true)
+        {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [&]() { return m_quit || (job = FindJob(0)) != nullptr; });
+                if (m_quit)
+                    return;
+            }
+            RunJob(*job);
+        }
+    }
+
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+
+    // Jobs that are running, oldest first
+    std::vector<std::shared_ptr<Job>> m_jobs;
+    uint64_t m_lastJobId = 0;
+    bool m_quit = false;
+};
+
+inline int GetNumThreads()
+{
+    return ThreadPool::Get().GetNumThreads();
+}
+
+template <typename LAMBDA>
+void ParallelFor(int count, const LAMBDA& fn)
+{
+    ThreadPool::Get().ParallelFor(count, fn);
+}
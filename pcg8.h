@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+
+#include "simd.h"
+
+// 8 PCG32 generators run side by side, for filling buffers with random numbers.
+// Lane i is exactly the generator GetRNG(seed, firstStream + i) gives, so every lane is its own pcg stream,
+// and a lane's numbers are the same ones the scalar pcg32_random_r would make.
+// Fill() writes the lanes interleaved: out[8 * k + i] is the k-th number of lane i.
+//
+// With AVX2, the 64 bit state update is done 4 lanes per register. AVX2 has no 64 bit multiply, so it is
+// made from three 32 x 32 -> 64 bit multiplies, which is all the low 64 bits of the product need.
+// Floats are made with BitsToFloat01 (a shift, a convert and a multiply) instead of a divide.
+struct PCG32x8
+{
+    static const int c_numLanes = 8;
+    static const uint64_t c_multiplier = 6364136223846793005ull;
+
+    PCG32x8(uint64_t seed, uint64_t firstStream)
+    {
+        for (int lane = 0; lane < c_numLanes; ++lane)
+        {
+            pcg32_random_t rng = GetRNG(seed, firstStream + lane);
+            m_state[lane] = rng.state;
+            m_inc[lane] = rng.inc;
+        }
+    }
+
+    // Fills out with count random numbers. If count isn't a multiple of 8, the numbers of the last step that
+    // didn't fit are thrown away, so every lane always moves forward together.
+    void Fill(uint32_t* out, size_t count)
+    {
+        size_t i = 0;
+        for (; i + c_numLanes <= count; i += c_numLanes)
+            Step(out + i);
+
+        if (i < count)
+        {
+            uint32_t last[c_numLanes];
+            Step(last);
+            std::copy(last, last + (count - i), out + i);
+        }
+    }
+
+    // Fills out with count random floats in [0,1)
+    void Fill(float* out, size_t count)
+    {
+        size_t i = 0;
+#if SIMD_AVX2()
+        for (; i + c_numLanes <= count; i += c_numLanes)
+        {
+            __m256i bits = StepAVX2();
+            __m256 f = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(bits, 8)), _mm256_set1_ps(1.0f / 16777216.0f));
+            _mm256_storeu_ps(out + i, f);
+        }
+#endif
+        uint32_t bits[c_numLanes];
+        for (; i < count; i += c_numLanes)
+        {
+            Step(bits);
+            for (size_t lane = 0; lane < c_numLanes && i + lane < count; ++lane)
+                out[i + lane] = BitsToFloat01(bits[lane]);
+        }
+    }
+
+    // Advances every lane once, writing one number per lane
+    void Step(uint32_t* out)
+    {
+#if SIMD_AVX2()
+        _mm256_storeu_si256((__m256i*)out, StepAVX2());
+#else
+        for (int lane = 0; lane < c_numLanes; ++lane)
+        {
+            // The same as pcg32_random_r
+            uint64_t oldState = m_state[lane];
+            m_state[lane] = oldState * c_multiplier + m_inc[lane];
+            uint32_t xorShifted = uint32_t(((oldState >> 18u) ^ oldState) >> 27u);
+            uint32_t rot = uint32_t(oldState >> 59u);
+            out[lane] = (xorShifted >> rot) | (xorShifted << ((~rot + 1u) & 31));
+        }
+#endif
+    }
+
+#if SIMD_AVX2()
+    __m256i StepAVX2()
+    {
+        __m256i low = StepLanes(m_state, m_inc);
+        __m256i high = StepLanes(m_state + 4, m_inc + 4);
+
+        // Each result is in the low 32 bits of a 64 bit lane. Move them to the bottom 128 bits, then join the two halves.
+        const __m256i pack = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+        low = _mm256_permutevar8x32_epi32(low, pack);
+        high = _mm256_permutevar8x32_epi32(high, pack);
+        return _mm256_permute2x128_si256(low, high, 0x20);
+    }
+
+    // pcg32_random_r on 4 lanes. Returns the 32 bit results in the low half of each 64 bit lane.
+    static __m256i StepLanes(uint64_t* stateArray, const uint64_t* incArray)
+    {
+        const __m256i multiplierLow = _mm256_set1_epi64x(int64_t(c_multiplier & 0xFFFFFFFF));
+        const __m256i multiplierHigh = _mm256_set1_epi64x(int64_t(c_multiplier >> 32));
+        const __m256i lowBits = _mm256_set1_epi64x(0xFFFFFFFF);
+
+        __m256i oldState = _mm256_loadu_si256((const __m256i*)stateArray);
+
+        // state * multiplier, mod 2^64 = low * low + ((high * low + low * high) << 32)
+        __m256i product = _mm256_mul_epu32(oldState, multiplierLow);
+        __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(oldState, 32), multiplierLow), _mm256_mul_epu32(oldState, multiplierHigh));
+        product = _mm256_add_epi64(product, _mm256_slli_epi64(cross, 32));
+        _mm256_storeu_si256((__m256i*)stateArray, _mm256_add_epi64(product, _mm256_loadu_si256((const __m256i*)incArray)));
+
+        // The output permutation
+        __m256i xorShifted = _mm256_and_si256(_mm256_srli_epi64(_mm256_xor_si256(_mm256_srli_epi64(oldState, 18), oldState), 27), lowBits);
+        __m256i rot = _mm256_srli_epi64(oldState, 59);
+        __m256i leftRot = _mm256_and_si256(_mm256_sub_epi64(_mm256_setzero_si256(), rot), _mm256_set1_epi64x(31));
+        return _mm256_and_si256(_mm256_or_si256(_mm256_srlv_epi64(xorShifted, rot), _mm256_sllv_epi64(xorShifted, leftRot)), lowBits);
+    }
+#endif
+
+    uint64_t m_state[c_numLanes];
+    uint64_t m_inc[c_numLanes];
+};
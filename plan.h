@@ -0,0 +1,189 @@
+#pragma once
+
+#include <stdio.h>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+
+#include "samples.h"
+#include "writer.h"
+
+// The optimal transport plan between two weighted point sets, or histograms, on the real line.
+// In 1D the monotone coupling is optimal for every p >= 1, so the plan is found by SweepMonotoneCoupling in
+// O(n + m) once the points are sorted, and has at most n + m - 1 entries.
+//
+// Entries are {index1, index2, mass}: mass moves from point index1 of the first set to point index2 of the second.
+// The indices are of the points as they were given, not sorted, and the masses add up to 1.
+// Plans are streamed out in blocks of entries, so a plan doesn't need to fit in memory. See TransportPlanFileWriter.
+
+struct TransportPlanEntry
+{
+    uint32_t index1;
+    uint32_t index2;
+    float mass;
+};
+static_assert(sizeof(TransportPlanEntry) == 12, "TransportPlanEntry is written to files as is");
+
+// The order of the points by position. Histograms are usually already sorted, and then this is just 0..n-1.
+inline std::vector<uint32_t> GetSortOrder(const float* positions, size_t count)
+{
+    std::vector<uint32_t> ret(count);
+    std::iota(ret.begin(), ret.end(), uint32_t(0));
+    if (!std::is_sorted(positions, positions + count))
+        std::stable_sort(ret.begin(), ret.end(), [positions](uint32_t A, uint32_t B) { return positions[A] < positions[B]; });
+    return ret;
+}
+
+// Calls sink(const TransportPlanEntry* entries, size_t count) with blocks of the plan, in quantile order.
+// Weights are optional, and don't need to be normalized. Each set can have at most 2^32 points.
+// Returns the number of entries.
+template <typename SINK>
+size_t ComputeTransportPlan(const float* positions1, const float* weights1, size_t count1, const float* positions2, const float* weights2, size_t count2, SINK&& sink)
+{
+    static const size_t c_blockSize = 4096;
+
+    std::vector<uint32_t> order1 = GetSortOrder(positions1, count1);
+    std::vector<uint32_t> order2 = GetSortOrder(positions2, count2);
+
+    // The weights in sorted order
+    std::vector<float> sortedWeights1;
+    std::vector<float> sortedWeights2;
+    if (weights1)
+    {
+        sortedWeights1.resize(count1);
+        for (size_t i = 0; i < count1; ++i)
+            sortedWeights1[i] = weights1[order1[i]];
+    }
+    if (weights2)
+    {
+        sortedWeights2.resize(count2);
+        for (size_t i = 0; i < count2; ++i)
+            sortedWeights2[i] = weights2[order2[i]];
+    }
+    INSTRUMENT_ALLOCATION("ComputeTransportPlan", (order1.size() + order2.size()) * sizeof(uint32_t) + (sortedWeights1.size() + sortedWeights2.size()) * sizeof(float));
+
+    std::vector<TransportPlanEntry> block(c_blockSize);
+    size_t blockCount = 0;
+    size_t ret = 0;
+    SweepMonotoneCoupling(weights1 ? sortedWeights1.data() : nullptr, count1, weights2 ? sortedWeights2.data() : nullptr, count2,
+        [&](size_t index1, size_t index2, double mass)
+        {
+            block[blockCount++] = { order1[index1], order2[index2], float(mass) };
+            if (blockCount == c_blockSize)
+            {
+                sink((const TransportPlanEntry*)block.data(), blockCount);
+                ret += blockCount;
+                blockCount = 0;
+            }
+        }
+    );
+
+    if (blockCount > 0)
+        sink((const TransportPlanEntry*)block.data(), blockCount);
+    return ret + blockCount;
+}
+
+// The whole plan, in memory
+inline std::vector<TransportPlanEntry> ComputeTransportPlan(const float* positions1, const float* weights1, size_t count1, const float* positions2, const float* weights2, size_t count2)
+{
+    std::vector<TransportPlanEntry> ret;
+    if (count1 > 0 && count2 > 0)
+        ret.reserve(count1 + count2 - 1);
+    ComputeTransportPlan(positions1, weights1, count1, positions2, weights2, count2,
+        [&](const TransportPlanEntry* entries, size_t count)
+        {
+            ret.insert(ret.end(), entries, entries + count);
+        }
+    );
+    return ret;
+}
+
+// Adds up the cost of moving mass under a plan, for any p. Use it as a sink to get the cost of a plan as it is made,
+// or call Add() on a stored plan. Get() is the p-Wasserstein distance, when the plan is optimal.
+struct TransportPlanCost
+{
+    TransportPlanCost(float p, const float* positions1, const float* positions2)
+        : m_p(p)
+        , m_positions1(positions1)
+        , m_positions2(positions2)
+    {
+    }
+
+    void Add(const TransportPlanEntry* entries, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            double distance = std::abs(double(m_positions1[entries[i].index1]) - double(m_positions2[entries[i].index2]));
+            m_sum.Add(double(entries[i].mass) * std::pow(distance, double(m_p)));
+        }
+    }
+
+    void operator()(const TransportPlanEntry* entries, size_t count)
+    {
+        Add(entries, count);
+    }
+
+    float Get() const
+    {
+        return (float)std::pow(m_sum.Get(), 1.0 / m_p);
+    }
+
+    float m_p = 1.0f;
+    const float* m_positions1 = nullptr;
+    const float* m_positions2 = nullptr;
+    KahanSum m_sum;
+};
+
+// Writes a plan to a file as it is made, for plans too big to keep in memory.
+// File format, in the byte order of the machine that wrote it:
+//   TransportPlanFileHeader
+//   TransportPlanEntry until the end of the file, so there are (file size - header size) / 12 of them
+struct TransportPlanFileHeader
+{
+    static const uint32_t c_version = 1;
+
+    char magic[8];      // "OT1DPLN"
+    uint32_t version;
+    uint32_t padding;
+    uint64_t count1;
+    uint64_t count2;
+};
+
+struct TransportPlanFileWriter
+{
+    TransportPlanFileWriter(const char* fileName, size_t count1, size_t count2)
+        : m_file(fileName, "wb")
+    {
+        if (!m_file.IsOpen())
+            return;
+
+        TransportPlanFileHeader header = {};
+        memcpy(header.magic, "OT1DPLN", 8);
+        header.version = TransportPlanFileHeader::c_version;
+        header.count1 = count1;
+        header.count2 = count2;
+        m_file.Write(&header, sizeof(header));
+    }
+
+    bool IsOpen() const
+    {
+        return m_file.IsOpen();
+    }
+
+    void operator()(const TransportPlanEntry* entries, size_t count)
+    {
+        if (m_file.IsOpen())
+            m_file.Write(entries, count * sizeof(TransportPlanEntry));
+    }
+
+    // Returns false if anything failed to write
+    bool Close()
+    {
+        return m_file.Close();
+    }
+
+    BufferedFileWriter m_file;
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cmath>
+#include <queue>
+#include <vector>
+
+// Adaptive Gauss-Kronrod quadrature. The 15 point Kronrod rule contains the 7 point Gauss rule, and the
+// difference between the two is used as the error estimate of an interval. The interval with the most
+// error is split in half until the total error is small enough.
+
+struct QuadratureResult
+{
+    double value = 0.0;
+    double error = 0.0;
+    int numEvaluations = 0;
+};
+
+struct WassersteinEstimate
+{
+    float distance = 0.0f;
+    float errorBound = 0.0f;
+    int numEvaluations = 0;
+};
+
+// Integrates fn over [a,b] with the 15 point Kronrod rule, using the embedded 7 point Gauss rule for the error
+template <typename LAMBDA>
+QuadratureResult GaussKronrod15(const LAMBDA& fn, double a, double b)
+{
+    // Nodes on [-1,1], from the largest down to the center. The odd indices are also the Gauss nodes.
+    static const double c_nodes[8] =
+    {
+        0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+        0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+        0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+        0.207784955007898467600689403773245, 0.000000000000000000000000000000000
+    };
+
+    static const double c_kronrodWeights[8] =
+    {
+        0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+        0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+        0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+        0.204432940075298892414161999234649, 0.209482141084727828012999174891714
+    };
+
+    static const double c_gaussWeights[4] =
+    {
+        0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+        0.381830050505118944950369775488975, 0.417959183673469387755102040816327
+    };
+
+    double center = 0.5 * (a + b);
+    double halfLength = 0.5 * (b - a);
+
+    double fCenter = fn(center);
+    double kronrod = fCenter * c_kronrodWeights[7];
+    double gauss = fCenter * c_gaussWeights[3];
+    for (int i = 0; i < 7; ++i)
+    {
+        double offset = halfLength * c_nodes[i];
+        double f = fn(center - offset) + fn(center + offset);
+        kronrod += f * c_kronrodWeights[i];
+        if (i & 1)
+            gauss += f * c_gaussWeights[i / 2];
+    }
+
+    QuadratureResult ret;
+    ret.value = kronrod * halfLength;
+    ret.error = std::abs((kronrod - gauss) * halfLength);
+    ret.numEvaluations = 15;
+    return ret;
+}
+
+// Integrates fn over [a,b], splitting intervals until the summed error estimate is below tolerance.
+// Gives up after maxIntervals intervals, in which case the reported error is larger than the tolerance.
+template <typename LAMBDA>
+QuadratureResult IntegrateAdaptive(const LAMBDA& fn, double a, double b, double tolerance, int maxIntervals = 10000)
+{
+    struct Interval
+    {
+        double a, b;
+        QuadratureResult result;
+
+        bool operator < (const Interval& other) const
+        {
+            return result.error < other.result.error;
+        }
+    };
+
+    std::priority_queue<Interval> intervals;
+    intervals.push({ a, b, GaussKronrod15(fn, a, b) });
+
+    QuadratureResult ret = intervals.top().result;
+    while (ret.error > tolerance && int(intervals.size()) < maxIntervals)
+    {
+        Interval worst = intervals.top();
+        intervals.pop();
+
+        double mid = 0.5 * (worst.a + worst.b);
+        Interval left = { worst.a, mid, GaussKronrod15(fn, worst.a, mid) };
+        Interval right = { mid, worst.b, GaussKronrod15(fn, mid, worst.b) };
+
+        ret.value += left.result.value + right.result.value - worst.result.value;
+        ret.error += left.result.error + right.result.error - worst.result.error;
+        ret.numEvaluations += left.result.numEvaluations + right.result.numEvaluations;
+
+        intervals.push(left);
+        intervals.push(right);
+    }
+
+    // Recalculate the totals from scratch, since the running sums above accumulate rounding error
+    ret.value = 0.0;
+    ret.error = 0.0;
+    while (!intervals.empty())
+    {
+        ret.value += intervals.top().result.value;
+        ret.error += intervals.top().result.error;
+        intervals.pop();
+    }
+    return ret;
+}
+
+// Converts an estimate of the integral of abs(ICDF1(x) - ICDF2(x))^p into a p-Wasserstein distance,
+// and converts the error of the integral into an error of the distance.
+inline WassersteinEstimate MakeWassersteinEstimate(float p, const QuadratureResult& integral)
+{
+    double value = std::max(integral.value, 0.0);
+    double distance = std::pow(value, 1.0 / p);
+    double distanceHigh = std::pow(value + integral.error, 1.0 / p);
+    double distanceLow = std::pow(std::max(value - integral.error, 0.0), 1.0 / p);
+
+    WassersteinEstimate ret;
+    ret.distance = float(distance);
+    ret.errorBound = float(std::max(distanceHigh - distance, distance - distanceLow));
+    ret.numEvaluations = integral.numEvaluations;
+    return ret;
+}
+
+// The tolerance given by the caller is on the distance, but the quadrature works on the integral, which is distance^p.
+// d(distance^p) = p * distance^(p-1) * d(distance), so a rough estimate of the integral is used to convert one into the other.
+inline double GetIntegralTolerance(float p, double roughIntegral, float tolerance)
+{
+    double roughDistance = std::pow(std::max(roughIntegral, 0.0), 1.0 / p);
+    double ret = double(tolerance) * double(p) * std::pow(roughDistance, double(p) - 1.0);
+    if (!(ret > 0.0) || !std::isfinite(ret))
+        ret = std::pow(double(tolerance), double(p));
+    return ret;
+}
+
+// Same integral as PWassersteinDistance but done with adaptive quadrature instead of random samples.
+// tolerance is the allowed error of the returned distance.
+template <typename PDF1, typename PDF2>
+WassersteinEstimate PWassersteinDistanceQuadrature(float p, const PDF1& pdf1, const PDF2& pdf2, float tolerance = 1e-6f)
+{
+    auto integrand = [&](double x)
+    {
+        float icdf1 = pdf1.ICDF(float(x));
+        float icdf2 = pdf2.ICDF(float(x));
+        return std::pow(std::abs((double)icdf1 - (double)icdf2), (double)p);
+    };
+
+    QuadratureResult rough = GaussKronrod15(integrand, 0.0, 1.0);
+    double integralTolerance = GetIntegralTolerance(p, rough.value, tolerance);
+
+    QuadratureResult integral = IntegrateAdaptive(integrand, 0.0, 1.0, integralTolerance);
+    integral.numEvaluations += rough.numEvaluations;
+
+    return MakeWassersteinEstimate(p, integral);
+}
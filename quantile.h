@@ -0,0 +1,147 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "parallel.h"
+#include "instrumentation.h"
+
+// A PDF described by its ICDF (quantile function), stored at evenly spaced u values: m_ICDFTable[i] = ICDF(i / (size - 1)).
+// ICDF is a constant time lerp between table entries, CDF is a binary search of the table, and the PDF is the slope of the CDF.
+struct PDFQuantile
+{
+    PDFQuantile() = default;
+
+    explicit PDFQuantile(std::vector<float>&& ICDFTable)
+        : m_ICDFTable(std::move(ICDFTable))
+    {
+    }
+
+    // Makes the table by evaluating the ICDF of another PDF
+    template <typename PDF>
+    static PDFQuantile FromPDF(const PDF& pdf, int numQuantiles = 1000)
+    {
+        std::vector<float> u(numQuantiles + 1);
+        for (int i = 0; i <= numQuantiles; ++i)
+            u[i] = float(i) / float(numQuantiles);
+
+        std::vector<float> ICDFTable(numQuantiles + 1);
+        INSTRUMENT_ALLOCATION("PDFQuantile::FromPDF", (u.size() + ICDFTable.size()) * sizeof(float));
+        pdf.ICDF(u.data(), ICDFTable.data(), u.size());
+        return PDFQuantile(std::move(ICDFTable));
+    }
+
+    float PDF(float x) const
+    {
+        if (x < m_ICDFTable.front() || x > m_ICDFTable.back())
+            return 0.0f;
+
+        int upperIndex = Clamp(int(std::upper_bound(m_ICDFTable.begin(), m_ICDFTable.end(), x) - m_ICDFTable.begin()), 1, NumSegments());
+        float width = m_ICDFTable[upperIndex] - m_ICDFTable[upperIndex - 1];
+        if (width <= 0.0f)
+            return 0.0f;
+        return 1.0f / (width * float(NumSegments()));
+    }
+
+    float CDF(float x) const
+    {
+        if (x < m_ICDFTable.front())
+            return 0.0f;
+
+        if (x >= m_ICDFTable.back())
+            return 1.0f;
+
+        int upperIndex = int(std::upper_bound(m_ICDFTable.begin(), m_ICDFTable.end(), x) - m_ICDFTable.begin());
+        float lowerValue = m_ICDFTable[upperIndex - 1];
+        float upperValue = m_ICDFTable[upperIndex];
+        float fraction = (x - lowerValue) / (upperValue - lowerValue);
+        return (float(upperIndex - 1) + fraction) / float(NumSegments());
+    }
+
+    float ICDF(float x) const
+    {
+        float index = Clamp(x, 0.0f, 1.0f) * float(NumSegments());
+        int index1 = std::min(int(index), NumSegments() - 1);
+        float fract = index - float(index1);
+        return Lerp(m_ICDFTable[index1], m_ICDFTable[index1 + 1], fract);
+    }
+
+    void PDF(const float* x, float* out, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = PDF(x[i]);
+    }
+
+    void CDF(const float* x, float* out, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = CDF(x[i]);
+    }
+
+    void ICDF(const float* x, float* out, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = ICDF(x[i]);
+    }
+
+    int NumSegments() const
+    {
+        return int(m_ICDFTable.size()) - 1;
+    }
+
+    std::vector<float> m_ICDFTable;
+};
+
+// The Wasserstein barycenter of count PDFs, which in 1D is the weighted average of their ICDFs.
+// The weights don't need to be normalized. Each PDF's ICDF is evaluated on the shared quantile grid in parallel,
+// then the weighted average is done in parallel over the grid, always adding in PDF order so the result is deterministic.
+template <typename PDF>
+PDFQuantile MakeWassersteinBarycenter(const PDF* pdfs, const float* weights, int count, int numQuantiles = 1000)
+{
+    int tableSize = numQuantiles + 1;
+    std::vector<float> u(tableSize);
+    for (int i = 0; i < tableSize; ++i)
+        u[i] = float(i) / float(numQuantiles);
+
+    // ICDFs[pdfIndex * tableSize + quantileIndex]
+    std::vector<float> ICDFs(size_t(count) * tableSize);
+    INSTRUMENT_ALLOCATION("MakeWassersteinBarycenter", (u.size() + ICDFs.size() + tableSize) * sizeof(float));
+    ParallelFor(count,
+        [&](int pdfIndex)
+        {
+            pdfs[pdfIndex].ICDF(u.data(), &ICDFs[size_t(pdfIndex) * tableSize], tableSize);
+        }
+    );
+
+    double totalWeight = 0.0;
+    for (int pdfIndex = 0; pdfIndex < count; ++pdfIndex)
+        totalWeight += weights[pdfIndex];
+
+    static const int c_chunkSize = 256;
+    std::vector<float> ICDFTable(tableSize);
+    ParallelFor((tableSize + c_chunkSize - 1) / c_chunkSize,
+        [&](int chunkIndex)
+        {
+            int begin = chunkIndex * c_chunkSize;
+            int end = std::min(begin + c_chunkSize, tableSize);
+            std::vector<double> sums(end - begin, 0.0);
+            for (int pdfIndex = 0; pdfIndex < count; ++pdfIndex)
+            {
+                double weight = double(weights[pdfIndex]) / totalWeight;
+                const float* ICDF = &ICDFs[size_t(pdfIndex) * tableSize];
+                for (int i = begin; i < end; ++i)
+                    sums[i - begin] += weight * double(ICDF[i]);
+            }
+            for (int i = begin; i < end; ++i)
+                ICDFTable[i] = float(sums[i - begin]);
+        }
+    );
+
+    return PDFQuantile(std::move(ICDFTable));
+}
+
+template <typename PDF>
+PDFQuantile MakeWassersteinBarycenter(const std::vector<PDF>& pdfs, const std::vector<float>& weights, int numQuantiles = 1000)
+{
+    return MakeWassersteinBarycenter(pdfs.data(), weights.data(), int(pdfs.size()), numQuantiles);
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include "parallel.h"
+#include "instrumentation.h"
+
+// p-Wasserstein distance between two sets of (optionally weighted) samples.
+// In 1D the optimal transport plan between sample sets is the monotone one: sort both sets, then walk them
+// together, matching up the mass in quantile order. Sorting dominates the cost, so it is done with a
+// parallel LSD radix sort.
+
+// Maps the bits of a float to an unsigned int which sorts in the same order as the float does.
+// Negative floats have all their bits flipped, positive floats only have their sign bit flipped.
+inline uint32_t FloatToRadixKey(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return (bits & 0x80000000) ? ~bits : (bits | 0x80000000);
+}
+
+inline float RadixKeyToFloat(uint32_t key)
+{
+    uint32_t bits = (key & 0x80000000) ? (key & 0x7FFFFFFF) : ~key;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// Sorts values ascending. If payload is given, it is reordered the same way as values.
+// Each pass sorts on 11 bits of the key. The values are split into chunks which are histogrammed and
+// scattered in parallel. Each chunk writes to its own range of every bucket, so the sort is stable and
+// the result doesn't depend on the thread count.
+inline void RadixSort(std::vector<float>& values, std::vector<float>* payload = nullptr)
+{
+    static const int c_digitBits = 11;
+    static const int c_numBuckets = 1 << c_digitBits;
+    static const int c_numPasses = (32 + c_digitBits - 1) / c_digitBits;
+
+    size_t count = values.size();
+    if (count < 2)
+        return;
+
+    size_t chunkSize = std::max<size_t>(count / (size_t(GetNumThreads()) * 4), 65536);
+    int numChunks = int((count + chunkSize - 1) / chunkSize);
+
+    std::vector<uint32_t> keys(count);
+    std::vector<uint32_t> keysTemp(count);
+    std::vector<float> payloadTemp(payload ? count : 0);
+
+    ParallelFor(numChunks,
+        [&](int chunkIndex)
+        {
+            size_t begin = size_t(chunkIndex) * chunkSize;
+            size_t end = std::min(begin + chunkSize, count);
+            for (size_t i = begin; i < end; ++i)
+                keys[i] = FloatToRadixKey(values[i]);
+        }
+    );
+
+    // histograms[chunkIndex * c_numBuckets + bucket]
+    std::vector<size_t> histograms(size_t(numChunks) * c_numBuckets);
+    INSTRUMENT_ALLOCATION("RadixSort", (keys.size() + keysTemp.size()) * sizeof(uint32_t) + payloadTemp.size() * sizeof(float) + histograms.size() * sizeof(size_t));
+    for (int pass = 0; pass < c_numPasses; ++pass)
+    {
+        int shift = pass * c_digitBits;
+
+        // count how many of each digit are in each chunk
+        ParallelFor(numChunks,
+            [&](int chunkIndex)
+            {
+                size_t* histogram = &histograms[size_t(chunkIndex) * c_numBuckets];
+                std::fill(histogram, histogram + c_numBuckets, 0);
+                size_t begin = size_t(chunkIndex) * chunkSize;
+                size_t end = std::min(begin + chunkSize, count);
+                for (size_t i = begin; i < end; ++i)
+                    histogram[(keys[i] >> shift) & (c_numBuckets - 1)]++;
+            }
+        );
+
+        // if every key has the same digit, this pass wouldn't change anything
+        bool skipPass = false;
+        for (int bucket = 0; bucket < c_numBuckets && !skipPass; ++bucket)
+        {
+            size_t bucketCount = 0;
+            for (int chunkIndex = 0; chunkIndex < numChunks; ++chunkIndex)
+                bucketCount += histograms[size_t(chunkIndex) * c_numBuckets + bucket];
+            skipPass = (bucketCount == count);
+        }
+        if (skipPass)
+            continue;
+
+        // turn the counts into write offsets: bucket major, then chunk order
+        size_t offset = 0;
+        for (int bucket = 0; bucket < c_numBuckets; ++bucket)
+        {
+            for (int chunkIndex = 0; chunkIndex < numChunks; ++chunkIndex)
+            {
+                size_t& histogramValue = histograms[size_t(chunkIndex) * c_numBuckets + bucket];
+                size_t bucketCount = histogramValue;
+                histogramValue = offset;
+                offset += bucketCount;
+            }
+        }
+
+        // scatter
+        ParallelFor(numChunks,
+            [&](int chunkIndex)
+            {
+                size_t* writeOffsets = &histograms[size_t(chunkIndex) * c_numBuckets];
+                size_t begin = size_t(chunkIndex) * chunkSize;
+                size_t end = std::min(begin + chunkSize, count);
+                for (size_t i = begin; i < end; ++i)
+                {
+                    size_t writeIndex = writeOffsets[(keys[i] >> shift) & (c_numBuckets - 1)]++;
+                    keysTemp[writeIndex] = keys[i];
+                    if (payload)
+                        payloadTemp[writeIndex] = (*payload)[i];
+                }
+            }
+        );
+
+        keys.swap(keysTemp);
+        if (payload)
+            payload->swap(payloadTemp);
+    }
+
+    ParallelFor(numChunks,
+        [&](int chunkIndex)
+        {
+            size_t begin = size_t(chunkIndex) * chunkSize;
+            size_t end = std::min(begin + chunkSize, count);
+            for (size_t i = begin; i < end; ++i)
+                values[i] = RadixKeyToFloat(keys[i]);
+        }
+    );
+}
+
+// Walks two sorted, weighted sample sets in quantile order, and calls fn(index1, index2, mass) for every
+// piece of mass that the monotone transport plan moves from samples1[index1] to samples2[index2].
+// The weights of each set are normalized to sum to 1. A null weights pointer means every sample has the same weight.
+// fn is called at most count1 + count2 - 1 times.
+template <typename LAMBDA>
+void SweepMonotoneCoupling(const float* weights1, size_t count1, const float* weights2, size_t count2, const LAMBDA& fn)
+{
+    if (count1 == 0 || count2 == 0)
+        return;
+
+    auto getTotal = [](const float* weights, size_t count)
+    {
+        if (!weights)
+            return double(count);
+        KahanSum sum;
+        for (size_t i = 0; i < count; ++i)
+            sum.Add(weights[i]);
+        return sum.Get();
+    };
+    double total1 = getTotal(weights1, count1);
+    double total2 = getTotal(weights2, count2);
+
+    // The cumulative mass at the end of the current sample of each set
+    size_t index1 = 0;
+    size_t index2 = 0;
+    double cumulative1 = (weights1 ? double(weights1[0]) : 1.0) / total1;
+    double cumulative2 = (weights2 ? double(weights2[0]) : 1.0) / total2;
+    double position = 0.0;
+    while (index1 < count1 && index2 < count2)
+    {
+        double nextPosition = std::min(cumulative1, cumulative2);
+        if (nextPosition > position)
+            fn(index1, index2, nextPosition - position);
+        position = nextPosition;
+
+        if (cumulative1 <= position)
+        {
+            index1++;
+            if (index1 < count1)
+                cumulative1 = weights1 ? cumulative1 + double(weights1[index1]) / total1 : double(index1 + 1) / total1;
+        }
+
+        if (cumulative2 <= position)
+        {
+            index2++;
+            if (index2 < count2)
+                cumulative2 = weights2 ? cumulative2 + double(weights2[index2]) / total2 : double(index2 + 1) / total2;
+        }
+    }
+}
+
+// Exact p-Wasserstein distance between two sample sets, which can be different sizes.
+// Weights are optional, and don't need to be normalized.
+inline float PWassersteinDistanceSamples(float p, const float* samples1, size_t count1, const float* samples2, size_t count2, const float* weights1 = nullptr, const float* weights2 = nullptr)
+{
+    std::vector<float> sorted1(samples1, samples1 + count1);
+    std::vector<float> sorted2(samples2, samples2 + count2);
+    std::vector<float> sortedWeights1;
+    std::vector<float> sortedWeights2;
+    if (weights1)
+        sortedWeights1.assign(weights1, weights1 + count1);
+    if (weights2)
+        sortedWeights2.assign(weights2, weights2 + count2);
+    INSTRUMENT_ALLOCATION("PWassersteinDistanceSamples", (sorted1.size() + sorted2.size() + sortedWeights1.size() + sortedWeights2.size()) * sizeof(float));
+
+    RadixSort(sorted1, weights1 ? &sortedWeights1 : nullptr);
+    RadixSort(sorted2, weights2 ? &sortedWeights2 : nullptr);
+
+    KahanSum sum;
+    SweepMonotoneCoupling(weights1 ? sortedWeights1.data() : nullptr, count1, weights2 ? sortedWeights2.data() : nullptr, count2,
+        [&](size_t index1, size_t index2, double mass)
+        {
+            sum.Add(mass * std::pow(std::abs(double(sorted1[index1]) - double(sorted2[index2])), double(p)));
+        }
+    );
+
+    return (float)std::pow(sum.Get(), 1.0 / p);
+}
+
+inline float PWassersteinDistanceSamples(float p, const std::vector<float>& samples1, const std::vector<float>& samples2)
+{
+    return PWassersteinDistanceSamples(p, samples1.data(), samples1.size(), samples2.data(), samples2.size());
+}
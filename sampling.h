@@ -0,0 +1,240 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "parallel.h"
+#include "pcg8.h"
+#include "instrumentation.h"
+#include "quadrature.h"
+
+template <typename PDF1, typename PDF2>
+float PWassersteinDistance(float p, const PDF1& pdf1, const PDF2& pdf2, int numSamples = 10000000)
+{
+    // https://www.imagedatascience.com/transport/OTCrashCourse.pdf page 45
+    // Integral from 0 to 1 of abs(ICDF1(x) - ICDF2(x))^p
+    // Then take the result to ^(1/p)
+    //
+    // The samples are split into fixed size chunks, and each chunk gets its own 8 pcg streams, one per lane of PCG32x8.
+    // The chunk sums are added together in chunk order, so the result is the same no matter
+    // how many threads there are.
+    static const int c_chunkSize = 65536;
+
+    // The average of no samples is 0
+    if (numSamples <= 0)
+        return 0.0f;
+
+    int numChunks = (numSamples + c_chunkSize - 1) / c_chunkSize;
+    uint64_t seed = GetRNGSeed();
+
+    std::vector<double> chunkSums(numChunks, 0.0);
+    INSTRUMENT_ALLOCATION("PWassersteinDistance", chunkSums.size() * sizeof(double));
+    ParallelFor(numChunks,
+        [&](int chunkIndex)
+        {
+            PCG32x8 rng(seed, uint64_t(chunkIndex) * PCG32x8::c_numLanes);
+            int begin = chunkIndex * c_chunkSize;
+            int end = std::min(begin + c_chunkSize, numSamples);
+
+            // evaluate the ICDFs in batches, using the batched ICDF functions
+            static const int c_batchSize = 1024;
+            float x[c_batchSize];
+            float icdf1[c_batchSize];
+            float icdf2[c_batchSize];
+
+            KahanSum sum;
+            for (int batchBegin = begin; batchBegin < end; batchBegin += c_batchSize)
+            {
+                int batchSize = std::min(c_batchSize, end - batchBegin);
+                rng.Fill(x, batchSize);
+
+                pdf1.ICDF(x, icdf1, batchSize);
+                pdf2.ICDF(x, icdf2, batchSize);
+
+                for (int i = 0; i < batchSize; ++i)
+                    sum.Add(std::pow(std::abs((double)icdf1[i] - (double)icdf2[i]), p));
+            }
+            chunkSums[chunkIndex] = sum.Get();
+        }
+    );
+
+    double ret = PairwiseSum(chunkSums.data(), chunkSums.size()) / double(numSamples);
+    return (float)std::pow(ret, 1.0f / p);
+}
+
+// p-Wasserstein distance by sampling the integral of abs(ICDF1(x) - ICDF2(x))^p, like PWassersteinDistance,
+// but with a choice of sample sequence, and stopping as soon as the estimate is accurate enough.
+//
+// The samples are split between c_numReplicates independently randomized copies of the sequence. The spread of
+// the per copy estimates gives the standard error of their average, which works for the low discrepancy sequences
+// too, where the samples within a copy are not independent. The number of samples per copy doubles every round,
+// until the confidence interval of the distance is within the tolerance.
+
+enum class SampleSequence
+{
+    WhiteNoise,     // independent uniform random numbers
+    Stratified,     // one jittered sample per equal sized stratum. Regenerated each round since it can't be extended.
+    R2,             // golden ratio additive recurrence, randomly shifted
+    Sobol,          // base 2 van der Corput (the first Sobol dimension), with a random digital shift
+    SobolOwen,      // base 2 van der Corput with hash based Owen scrambling
+};
+
+struct SamplingSettings
+{
+    SampleSequence sequence = SampleSequence::SobolOwen;
+    float tolerance = 1e-4f;    // the allowed half width of the confidence interval of the distance
+    float zScore = 1.96f;       // 1.96 is a 95% confidence interval
+    int maxSamples = 10000000;
+};
+
+inline uint32_t ReverseBits(uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+    x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+    x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// From "Practical Hash-based Owen Scrambling", Brent Burley 2020.
+// A hash where each bit only depends on the bits below it, so when applied to reversed bits,
+// it is a nested uniform (Owen) scramble.
+inline uint32_t LaineKarrasPermutation(uint32_t x, uint32_t seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+template <typename PDF1, typename PDF2>
+WassersteinEstimate PWassersteinDistanceSampled(float p, const PDF1& pdf1, const PDF2& pdf2, const SamplingSettings& settings = SamplingSettings())
+{
+    static const int c_numReplicates = 16;
+    static const int c_firstRoundSamples = 64;
+    static const int c_batchSize = 1024;
+
+    struct Replicate
+    {
+        Replicate(const pcg32_random_t& rng, const PCG32x8& laneRNG)
+            : rng(rng)
+            , laneRNG(laneRNG)
+        {
+        }
+
+        pcg32_random_t rng;
+        PCG32x8 laneRNG;    // for white noise and stratified sampling
+        uint32_t randomBits = 0;
+        double shift = 0.0;
+        KahanSum sum;
+        int count = 0;
+    };
+
+    uint64_t seed = GetRNGSeed();
+    // Replicate i uses pcg stream i, and streams c_numReplicates + 8 * i onwards for its lanes
+    std::vector<Replicate> replicates;
+    for (int replicateIndex = 0; replicateIndex < c_numReplicates; ++replicateIndex)
+    {
+        Replicate replicate(GetRNG(seed, replicateIndex), PCG32x8(seed, c_numReplicates + PCG32x8::c_numLanes * replicateIndex));
+        replicate.randomBits = pcg32_random_r(&replicate.rng);
+        replicate.shift = RandomFloat01(replicate.rng);
+        replicates.push_back(replicate);
+    }
+
+    WassersteinEstimate ret;
+    int samplesPerReplicate = c_firstRoundSamples;
+    while (true)
+    {
+        // bring every replicate up to samplesPerReplicate samples
+        ParallelFor(c_numReplicates,
+            [&](int replicateIndex)
+            {
+                Replicate& replicate = replicates[replicateIndex];
+
+                // A stratified set can't be extended, so start a new one with twice as many strata
+                if (settings.sequence == SampleSequence::Stratified)
+                {
+                    replicate.sum = KahanSum();
+                    replicate.count = 0;
+                }
+
+                float x[c_batchSize];
+                float icdf1[c_batchSize];
+                float icdf2[c_batchSize];
+                while (replicate.count < samplesPerReplicate)
+                {
+                    int batchSize = std::min(c_batchSize, samplesPerReplicate - replicate.count);
+                    if (settings.sequence == SampleSequence::WhiteNoise || settings.sequence == SampleSequence::Stratified)
+                        replicate.laneRNG.Fill(x, batchSize);
+
+                    for (int i = 0; i < batchSize; ++i)
+                    {
+                        uint32_t sampleIndex = uint32_t(replicate.count + i);
+                        switch (settings.sequence)
+                        {
+                            case SampleSequence::WhiteNoise:
+                                break;
+                            case SampleSequence::Stratified:
+                                x[i] = std::min((float(sampleIndex) + x[i]) / float(samplesPerReplicate), 1.0f);
+                                break;
+                            case SampleSequence::R2:
+                            {
+                                double value = replicate.shift + double(sampleIndex) * 0.61803398874989484820;
+                                x[i] = float(value - std::floor(value));
+                                break;
+                            }
+                            case SampleSequence::Sobol:
+                                x[i] = BitsToFloat01(ReverseBits(sampleIndex) ^ replicate.randomBits);
+                                break;
+                            case SampleSequence::SobolOwen:
+                                x[i] = BitsToFloat01(ReverseBits(LaineKarrasPermutation(sampleIndex, replicate.randomBits)));
+                                break;
+                        }
+                    }
+
+                    pdf1.ICDF(x, icdf1, batchSize);
+                    pdf2.ICDF(x, icdf2, batchSize);
+                    for (int i = 0; i < batchSize; ++i)
+                        replicate.sum.Add(std::pow(std::abs((double)icdf1[i] - (double)icdf2[i]), p));
+
+                    replicate.count += batchSize;
+                }
+            }
+        );
+
+        // The mean and standard error of the replicate estimates of the integral
+        double mean = 0.0;
+        for (const Replicate& replicate : replicates)
+            mean += replicate.sum.Get() / double(replicate.count);
+        mean /= double(c_numReplicates);
+
+        double variance = 0.0;
+        for (const Replicate& replicate : replicates)
+        {
+            double difference = replicate.sum.Get() / double(replicate.count) - mean;
+            variance += difference * difference;
+        }
+        variance /= double(c_numReplicates - 1);
+        double standardError = std::sqrt(variance / double(c_numReplicates));
+
+        QuadratureResult integral;
+        integral.value = mean;
+        integral.error = double(settings.zScore) * standardError;
+        integral.numEvaluations = samplesPerReplicate * c_numReplicates;
+        ret = MakeWassersteinEstimate(p, integral);
+
+        if (ret.errorBound <= settings.tolerance || samplesPerReplicate * 2 * c_numReplicates > settings.maxSamples)
+            break;
+
+        samplesPerReplicate *= 2;
+    }
+
+    // For stratified sampling, the samples of earlier rounds were thrown away, but they still cost ICDF evaluations
+    if (settings.sequence == SampleSequence::Stratified)
+        ret.numEvaluations = 2 * ret.numEvaluations - c_firstRoundSamples * c_numReplicates;
+
+    return ret;
+}
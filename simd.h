@@ -0,0 +1,57 @@
+#pragma once
+
+// SIMD_AVX2() is true when the compiler is allowed to use AVX2 (/arch:AVX2 or -mavx2).
+// The batched PDF / CDF / ICDF functions use it to work on 8 floats at a time, and fall back
+// to calling the scalar functions otherwise, and for whatever is left over at the end.
+#ifndef SIMD_AVX2
+    #if defined(__AVX2__)
+        #define SIMD_AVX2() true
+    #else
+        #define SIMD_AVX2() false
+    #endif
+#endif
+
+#if SIMD_AVX2()
+
+#include <immintrin.h>
+
+// Same as Clamp() for each lane
+inline __m256 SIMDClamp(__m256 x, float themin, float themax)
+{
+    return _mm256_max_ps(_mm256_min_ps(x, _mm256_set1_ps(themax)), _mm256_set1_ps(themin));
+}
+
+// Same as Lerp() for each lane
+inline __m256 SIMDLerp(__m256 A, __m256 B, __m256 t)
+{
+    __m256 oneMinusT = _mm256_sub_ps(_mm256_set1_ps(1.0f), t);
+    return _mm256_add_ps(_mm256_mul_ps(A, oneMinusT), _mm256_mul_ps(B, t));
+}
+
+// Lanes where themin <= x <= themax
+inline __m256 SIMDInRange(__m256 x, float themin, float themax)
+{
+    return _mm256_and_ps(_mm256_cmp_ps(x, _mm256_set1_ps(themin), _CMP_GE_OQ), _mm256_cmp_ps(x, _mm256_set1_ps(themax), _CMP_LE_OQ));
+}
+
+// Cube root of x >= 0.
+// Dividing the float bits by 3 and adding a bias gets within a few percent of the answer,
+// and three Newton iterations take that to float precision.
+inline __m256 SIMDCbrt(__m256 x)
+{
+    __m256i bits = _mm256_castps_si256(x);
+    bits = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(bits), _mm256_set1_ps(1.0f / 3.0f)));
+    bits = _mm256_add_epi32(bits, _mm256_set1_epi32(709958130));
+    __m256 y = _mm256_castsi256_ps(bits);
+
+    // y = (2y + x / y^2) / 3
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 third = _mm256_set1_ps(1.0f / 3.0f);
+    for (int i = 0; i < 3; ++i)
+        y = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(two, y), _mm256_div_ps(x, _mm256_mul_ps(y, y))), third);
+
+    // the bias would make the cube root of 0 not be 0
+    return _mm256_andnot_ps(_mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_EQ_OQ), y);
+}
+
+#endif
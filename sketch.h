@@ -0,0 +1,207 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// A distribution made from a stream of values, kept in a fixed amount of memory using a KLL quantile sketch.
+// https://arxiv.org/abs/1603.05346
+//
+// Values are added to level 0. When a level gets too full it is sorted, and every other value (starting at a
+// random one of the first two) moves up to the next level, where it counts as two values. Higher levels get
+// more capacity, so the sketch holds about 3 * k values no matter how many values it has seen.
+//
+// The rank error (how far CDF() can be off, as a fraction of the count) is about 1.7 / k with high probability,
+// so the default k = 200 gives about 1% and k = 2000 gives about 0.1%. Sketches can be merged, so that each
+// thread or shard can fill its own sketch, and they can be combined at the end.
+//
+// Call Finalize() after adding or merging values, before using PDF / CDF / ICDF.
+// CDF and ICDF are piecewise linear through the midpoint of the mass of each stored value.
+struct PDFSketch
+{
+    PDFSketch(int k = 200, uint64_t stream = 0)
+        : m_k(k)
+    {
+        m_rng = GetRNG(GetRNGSeed(), stream);
+        SetNumLevels(1);
+    }
+
+    void Add(float x)
+    {
+        m_levels[0].push_back(x);
+        m_numItems++;
+        m_count++;
+        Compress();
+    }
+
+    void Merge(const PDFSketch& other)
+    {
+        if (other.m_levels.size() > m_levels.size())
+            SetNumLevels(other.m_levels.size());
+
+        for (size_t level = 0; level < other.m_levels.size(); ++level)
+            m_levels[level].insert(m_levels[level].end(), other.m_levels[level].begin(), other.m_levels[level].end());
+
+        m_numItems += other.m_numItems;
+        m_count += other.m_count;
+        Compress();
+    }
+
+    // Makes the sorted table that PDF / CDF / ICDF use
+    void Finalize()
+    {
+        std::vector<std::pair<float, double>> items;
+        items.reserve(m_numItems);
+        for (size_t level = 0; level < m_levels.size(); ++level)
+        {
+            double weight = std::ldexp(1.0, int(level));
+            for (float f : m_levels[level])
+                items.push_back({ f, weight });
+        }
+        std::sort(items.begin(), items.end(), [](const auto& A, const auto& B) { return A.first < B.first; });
+
+        double total = 0.0;
+        for (const auto& item : items)
+            total += item.second;
+
+        m_values.resize(items.size());
+        m_masses.resize(items.size());
+        double cumulative = 0.0;
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            m_values[i] = items[i].first;
+            m_masses[i] = float((cumulative + 0.5 * items[i].second) / total);
+            cumulative += items[i].second;
+        }
+    }
+
+    float PDF(float x) const
+    {
+        if (m_values.size() < 2 || x < m_values.front() || x > m_values.back())
+            return 0.0f;
+
+        size_t upperIndex = std::max<size_t>(std::upper_bound(m_values.begin(), m_values.end(), x) - m_values.begin(), 1);
+        upperIndex = std::min(upperIndex, m_values.size() - 1);
+        float width = m_values[upperIndex] - m_values[upperIndex - 1];
+        if (width <= 0.0f)
+            return 0.0f;
+        return (m_masses[upperIndex] - m_masses[upperIndex - 1]) / width;
+    }
+
+    float CDF(float x) const
+    {
+        if (m_values.empty() || x < m_values.front())
+            return 0.0f;
+
+        if (x >= m_values.back())
+            return 1.0f;
+
+        size_t upperIndex = std::upper_bound(m_values.begin(), m_values.end(), x) - m_values.begin();
+        float lowerValue = m_values[upperIndex - 1];
+        float upperValue = m_values[upperIndex];
+        float fraction = (x - lowerValue) / (upperValue - lowerValue);
+        return Lerp(m_masses[upperIndex - 1], m_masses[upperIndex], fraction);
+    }
+
+    float ICDF(float x) const
+    {
+        if (m_values.empty())
+            return 0.0f;
+
+        if (x <= m_masses.front())
+            return m_values.front();
+
+        if (x >= m_masses.back())
+            return m_values.back();
+
+        size_t upperIndex = std::lower_bound(m_masses.begin(), m_masses.end(), x) - m_masses.begin();
+        float lowerMass = m_masses[upperIndex - 1];
+        float upperMass = m_masses[upperIndex];
+        float fraction = (x - lowerMass) / (upperMass - lowerMass);
+        return Lerp(m_values[upperIndex - 1], m_values[upperIndex], fraction);
+    }
+
+    void PDF(const float* x, float* out, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = PDF(x[i]);
+    }
+
+    void CDF(const float* x, float* out, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = CDF(x[i]);
+    }
+
+    void ICDF(const float* x, float* out, size_t count) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = ICDF(x[i]);
+    }
+
+    // The number of values added to this sketch and the sketches merged into it
+    uint64_t Count() const
+    {
+        return m_count;
+    }
+
+    // The number of values actually stored
+    size_t NumItems() const
+    {
+        return m_numItems;
+    }
+
+private:
+    // Capacities depend on how far a level is from the top, so they are worked out again whenever a level is added,
+    // rather than on every Add()
+    void SetNumLevels(size_t numLevels)
+    {
+        m_levels.resize(numLevels);
+        m_capacities.resize(numLevels);
+        m_totalCapacity = 0;
+        for (size_t level = 0; level < numLevels; ++level)
+        {
+            size_t depth = numLevels - 1 - level;
+            m_capacities[level] = std::max<size_t>(2, size_t(std::ceil(double(m_k) * std::pow(2.0 / 3.0, double(depth)))));
+            m_totalCapacity += m_capacities[level];
+        }
+    }
+
+    void Compress()
+    {
+        while (m_numItems >= m_totalCapacity)
+        {
+            for (size_t level = 0; level < m_levels.size(); ++level)
+            {
+                if (m_levels[level].size() < m_capacities[level])
+                    continue;
+
+                if (level + 1 == m_levels.size())
+                    SetNumLevels(m_levels.size() + 1);
+
+                // Promote every other value of an even number of values, leaving the largest one behind if the count is odd
+                std::vector<float>& items = m_levels[level];
+                std::sort(items.begin(), items.end());
+                size_t numCompacted = items.size() & ~size_t(1);
+                size_t offset = pcg32_random_r(&m_rng) & 1;
+                for (size_t i = offset; i < numCompacted; i += 2)
+                    m_levels[level + 1].push_back(items[i]);
+                items.erase(items.begin(), items.begin() + numCompacted);
+                m_numItems -= numCompacted / 2;
+                break;
+            }
+        }
+    }
+
+    int m_k = 200;
+    pcg32_random_t m_rng;
+    std::vector<std::vector<float>> m_levels;
+    std::vector<size_t> m_capacities;   // of each level
+    size_t m_totalCapacity = 0;
+    size_t m_numItems = 0;
+    uint64_t m_count = 0;
+
+    // made by Finalize()
+    std::vector<float> m_values;
+    std::vector<float> m_masses;
+};
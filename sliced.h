@@ -0,0 +1,246 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "simd.h"
+#include "parallel.h"
+#include "quadrature.h"
+#include "samples.h"
+#include "distancematrix.h"
+
+// Sliced p-Wasserstein distance between two point sets of any dimension.
+// Both point sets are projected onto a random direction (a slice), which makes them 1D sample sets, and the
+// 1D distance between those is exact: sort both and walk them together. SW_p^p is the average of the
+// 1D W_p^p over all directions, which is estimated by averaging over many slices.
+//
+// Slices are done in rounds, in parallel over the slices of a round. After each round the spread of the
+// per slice values gives a confidence interval, and it stops when that is within the tolerance.
+// Each slice's direction comes from its own pcg stream (or its index in a QMC sequence), so the directions,
+// and the result, don't depend on the thread count. The confidence interval treats the slices as independent,
+// which overstates the error of QMC directions, so they stop no sooner than random ones, but are usually more accurate.
+
+enum class SliceDirections
+{
+    Random,     // normally distributed vectors from pcg, normalized
+    R,          // the R_d (generalized golden ratio) sequence, randomly shifted, mapped to normal vectors by Box-Muller
+};
+
+struct SlicedSettings
+{
+    SliceDirections directions = SliceDirections::R;
+    float tolerance = 1e-3f;    // the allowed half width of the confidence interval of the distance
+    float zScore = 1.96f;       // 1.96 is a 95% confidence interval
+    int maxSlices = 4096;       // at least 1 slice is always used, even if this is <= 0
+};
+
+// Points stored a dimension at a time (structure of arrays), so projections can work on 8 points at once.
+// Each dimension's column is 64 byte aligned and padded to a multiple of 16 floats.
+struct PointSet
+{
+    static const int c_columnAlignment = 16;
+
+    PointSet(int numDimensions, size_t numPoints)
+        : m_numDimensions(numDimensions)
+        , m_numPoints(numPoints)
+        , m_stride((numPoints + c_columnAlignment - 1) / c_columnAlignment * c_columnAlignment)
+    {
+        m_values.resize(size_t(m_numDimensions) * m_stride, 0.0f);
+    }
+
+    // Makes a point set from points stored one after another: x0 y0 z0 x1 y1 z1 ...
+    static PointSet FromInterleaved(const float* points, int numDimensions, size_t numPoints)
+    {
+        PointSet ret(numDimensions, numPoints);
+        for (size_t i = 0; i < numPoints; ++i)
+            for (int dimension = 0; dimension < numDimensions; ++dimension)
+                ret.Column(dimension)[i] = points[i * numDimensions + dimension];
+        return ret;
+    }
+
+    float* Column(int dimension)
+    {
+        return &m_values[size_t(dimension) * m_stride];
+    }
+
+    const float* Column(int dimension) const
+    {
+        return &m_values[size_t(dimension) * m_stride];
+    }
+
+    // out[i] = dot(point i, direction). out needs room for m_stride values.
+    void Project(const float* direction, float* out) const
+    {
+#if SIMD_AVX2()
+        for (size_t i = 0; i < m_stride; i += 8)
+        {
+            __m256 sum = _mm256_setzero_ps();
+            for (int dimension = 0; dimension < m_numDimensions; ++dimension)
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(direction[dimension]), _mm256_load_ps(Column(dimension) + i)));
+            _mm256_storeu_ps(out + i, sum);
+        }
+#else
+        std::fill(out, out + m_stride, 0.0f);
+        for (int dimension = 0; dimension < m_numDimensions; ++dimension)
+        {
+            const float* column = Column(dimension);
+            for (size_t i = 0; i < m_numPoints; ++i)
+                out[i] += direction[dimension] * column[i];
+        }
+#endif
+    }
+
+    int m_numDimensions = 0;
+    size_t m_numPoints = 0;
+    size_t m_stride = 0;
+    std::vector<float, AlignedAllocator<float, 64>> m_values;
+};
+
+// The alphas of the R_d sequence: 1/phi^k for k = 1..d, where phi is the positive root of x^(d+1) = x + 1.
+// http://extremelearning.com.au/unreasonable-effectiveness-of-quasirandom-sequences/
+inline std::vector<double> GetRSequenceAlphas(int numDimensions)
+{
+    double phi = 2.0;
+    for (int i = 0; i < 30; ++i)
+        phi = std::pow(1.0 + phi, 1.0 / double(numDimensions + 1));
+
+    std::vector<double> ret(numDimensions);
+    double alpha = 1.0;
+    for (double& a : ret)
+    {
+        alpha /= phi;
+        a = alpha;
+    }
+    return ret;
+}
+
+// Makes the unit length direction of a slice. Normally distributed vectors point in uniformly random directions.
+inline void GetSliceDirection(SliceDirections directions, uint64_t seed, int sliceIndex, const std::vector<double>& alphas, const std::vector<double>& shifts, float* direction, int numDimensions)
+{
+    // Box-Muller takes uniform numbers two at a time
+    std::vector<double> uniform((numDimensions + 1) & ~1);
+    if (directions == SliceDirections::Random)
+    {
+        pcg32_random_t rng = GetRNG(seed, sliceIndex);
+        for (double& u : uniform)
+            u = RandomFloat01(rng);
+    }
+    else
+    {
+        for (size_t i = 0; i < uniform.size(); ++i)
+        {
+            double value = shifts[i] + double(sliceIndex) * alphas[i];
+            uniform[i] = value - std::floor(value);
+        }
+    }
+
+    double lengthSquared = 0.0;
+    std::vector<double> normal(uniform.size());
+    for (size_t i = 0; i < uniform.size(); i += 2)
+    {
+        double radius = std::sqrt(-2.0 * std::log(1.0 - uniform[i]));
+        double angle = 2.0 * 3.14159265358979323846 * uniform[i + 1];
+        normal[i] = radius * std::cos(angle);
+        normal[i + 1] = radius * std::sin(angle);
+    }
+    for (int i = 0; i < numDimensions; ++i)
+        lengthSquared += normal[i] * normal[i];
+
+    double scale = lengthSquared > 0.0 ? 1.0 / std::sqrt(lengthSquared) : 0.0;
+    for (int i = 0; i < numDimensions; ++i)
+        direction[i] = float(normal[i] * scale);
+}
+
+// Both point sets need the same number of dimensions, but can have different numbers of points.
+// If the dimensions differ, the distance is NaN and no slices are used.
+// numEvaluations of the result is the number of slices used.
+inline WassersteinEstimate SlicedPWassersteinDistance(float p, const PointSet& points1, const PointSet& points2, const SlicedSettings& settings = SlicedSettings())
+{
+    static const int c_slicesPerRound = 32;
+
+    // The direction of a slice only has points1's number of dimensions
+    if (points1.m_numDimensions != points2.m_numDimensions)
+    {
+        WassersteinEstimate ret;
+        ret.distance = std::numeric_limits<float>::quiet_NaN();
+        return ret;
+    }
+
+    int numDimensions = points1.m_numDimensions;
+    uint64_t seed = GetRNGSeed();
+
+    // The R_d sequence is in an even number of dimensions for Box-Muller, and gets one random shift for all slices
+    int numUniforms = (numDimensions + 1) & ~1;
+    std::vector<double> alphas = GetRSequenceAlphas(numUniforms);
+    std::vector<double> shifts(numUniforms);
+    if (settings.directions == SliceDirections::R)
+    {
+        pcg32_random_t rng = GetRNG(seed, 0);
+        for (double& shift : shifts)
+            shift = RandomFloat01(rng);
+    }
+
+    int maxSlices = std::max(settings.maxSlices, 1);
+    std::vector<double> sliceValues;
+    WassersteinEstimate ret;
+    while (true)
+    {
+        int roundBegin = int(sliceValues.size());
+        int roundSize = std::min(c_slicesPerRound, maxSlices - roundBegin);
+        sliceValues.resize(roundBegin + roundSize);
+
+        ParallelFor(roundSize,
+            [&](int roundIndex)
+            {
+                int sliceIndex = roundBegin + roundIndex;
+                std::vector<float> direction(numDimensions);
+                GetSliceDirection(settings.directions, seed, sliceIndex, alphas, shifts, direction.data(), numDimensions);
+
+                std::vector<float> projected1(points1.m_stride);
+                std::vector<float> projected2(points2.m_stride);
+                points1.Project(direction.data(), projected1.data());
+                points2.Project(direction.data(), projected2.data());
+                projected1.resize(points1.m_numPoints);
+                projected2.resize(points2.m_numPoints);
+
+                // RadixSort's parallel loops are nested in this one, and share the threads with the other slices
+                RadixSort(projected1);
+                RadixSort(projected2);
+
+                KahanSum sum;
+                SweepMonotoneCoupling(nullptr, projected1.size(), nullptr, projected2.size(),
+                    [&](size_t index1, size_t index2, double mass)
+                    {
+                        sum.Add(mass * std::pow(std::abs(double(projected1[index1]) - double(projected2[index2])), double(p)));
+                    }
+                );
+                sliceValues[sliceIndex] = sum.Get();
+            }
+        );
+
+        // The mean and standard error of the per slice W_p^p, added in slice order
+        int numSlices = int(sliceValues.size());
+        double mean = 0.0;
+        for (double value : sliceValues)
+            mean += value;
+        mean /= double(numSlices);
+
+        double variance = 0.0;
+        for (double value : sliceValues)
+            variance += (value - mean) * (value - mean);
+        variance /= double(std::max(numSlices - 1, 1));
+
+        QuadratureResult integral;
+        integral.value = mean;
+        integral.error = double(settings.zScore) * std::sqrt(variance / double(numSlices));
+        integral.numEvaluations = numSlices;
+        ret = MakeWassersteinEstimate(p, integral);
+
+        if (ret.errorBound <= settings.tolerance || numSlices >= maxSlices)
+            break;
+    }
+
+    return ret;
+}
@@ -0,0 +1,405 @@
+#pragma once
+
+#include <stdio.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <algorithm>
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+#include "numeric.h"
+
+// A file of built PDFNumeric tables, so they don't need to be rebuilt from 10000 density evaluations every run.
+// The file is memory mapped, and the tables are used in place as read only PDFNumericViewT's, without being
+// copied or even read until they are used. Opening the cache maps the file and checks the list of entries, but
+// doesn't touch the tables, so startup is almost free. Each table has a checksum, which is checked the first time
+// the table is used, since a bad ICDF guide entry would make lookups read outside of the table.
+//
+// Tables are looked up by a 64 bit FNV-1a hash of an identifier for the density, and the table parameters.
+// The identifier needs to change whenever the density does, since the cache can't tell otherwise.
+//
+// File format, in the byte order of the machine that wrote it:
+//   PDFTableFileHeader
+//   PDFTableFileEntry[numEntries], sorted by key
+//   the tables, each one c_CDFSamples floats followed by c_ICDFGuideSize ints, starting on a 64 byte boundary
+// A file with a different version or table parameters, or a broken list of entries, is ignored, and gets rebuilt.
+// A table that doesn't match its checksum is ignored, and just that table gets rebuilt.
+
+struct PDFTableFileHeader
+{
+    static const uint32_t c_version = 2;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t PDFSamples;
+    uint32_t CDFSamples;
+    uint32_t ICDFGuideSize;
+    uint64_t numEntries;
+};
+
+struct PDFTableFileEntry
+{
+    uint64_t key;
+    uint64_t offset;    // from the start of the file
+    uint64_t checksum;  // HashFNV1a of the c_tableSize bytes of the table
+};
+
+inline uint64_t HashFNV1a(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// A read only view of a whole file. Pages are loaded by the OS as they are touched.
+struct MappedFile
+{
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator = (const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+        Close();
+    }
+
+    bool Open(const char* fileName)
+    {
+        Close();
+#if defined(_WIN32)
+        HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+        {
+            CloseHandle(file);
+            return false;
+        }
+
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping)
+            return false;
+
+        m_data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (!m_data)
+            return false;
+        m_size = size_t(size.QuadPart);
+#else
+        int file = open(fileName, O_RDONLY);
+        if (file < 0)
+            return false;
+
+        struct stat fileStat;
+        if (fstat(file, &fileStat) != 0 || fileStat.st_size == 0)
+        {
+            close(file);
+            return false;
+        }
+
+        void* data = mmap(nullptr, size_t(fileStat.st_size), PROT_READ, MAP_SHARED, file, 0);
+        close(file);
+        if (data == MAP_FAILED)
+            return false;
+
+        m_data = data;
+        m_size = size_t(fileStat.st_size);
+#endif
+        return true;
+    }
+
+    void Close()
+    {
+        if (!m_data)
+            return;
+#if defined(_WIN32)
+        UnmapViewOfFile(m_data);
+#else
+        munmap(m_data, m_size);
+#endif
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    const unsigned char* Data() const
+    {
+        return (const unsigned char*)m_data;
+    }
+
+    size_t Size() const
+    {
+        return m_size;
+    }
+
+private:
+    void* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+// Renames fromFileName to toFileName, replacing toFileName if it exists. The replacement is a single rename,
+// so anything opening toFileName sees either the old file or the new one, and the old one is kept if it fails.
+inline bool RenameReplacing(const char* fromFileName, const char* toFileName)
+{
+#if defined(_WIN32)
+    return MoveFileExA(fromFileName, toFileName, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(fromFileName, toFileName) == 0;
+#endif
+}
+
+template <int TPDFSamples = 10000, int TCDFSamples = 100>
+struct PDFTableCacheT
+{
+    typedef PDFNumericViewT<TCDFSamples> View;
+
+    static const int c_PDFSamples = TPDFSamples;
+    static const int c_CDFSamples = TCDFSamples;
+    static const int c_ICDFGuideSize = View::c_ICDFGuideSize;
+    static const size_t c_tableAlignment = 64;
+    static const size_t c_tableSize = (sizeof(float) * c_CDFSamples + sizeof(int) * c_ICDFGuideSize + c_tableAlignment - 1) / c_tableAlignment * c_tableAlignment;
+
+    // Maps the file, if there is a valid one
+    explicit PDFTableCacheT(const char* fileName)
+    {
+        if (!m_file.Open(fileName))
+            return;
+
+        const PDFTableFileHeader* header = (const PDFTableFileHeader*)m_file.Data();
+        bool valid = m_file.Size() >= sizeof(PDFTableFileHeader) &&
+            memcmp(header->magic, c_magic, sizeof(header->magic)) == 0 &&
+            header->version == PDFTableFileHeader::c_version &&
+            header->PDFSamples == uint32_t(c_PDFSamples) &&
+            header->CDFSamples == uint32_t(c_CDFSamples) &&
+            header->ICDFGuideSize == uint32_t(c_ICDFGuideSize) &&
+            header->numEntries <= (m_file.Size() - sizeof(PDFTableFileHeader)) / sizeof(PDFTableFileEntry);
+
+        // Every entry is checked once here, so that Find() and Write() can use them without checking
+        const PDFTableFileEntry* entries = (const PDFTableFileEntry*)(m_file.Data() + sizeof(PDFTableFileHeader));
+        for (size_t i = 0; valid && i < size_t(header->numEntries); ++i)
+        {
+            valid = entries[i].offset % c_tableAlignment == 0 &&
+                entries[i].offset <= m_file.Size() &&
+                c_tableSize <= m_file.Size() - entries[i].offset &&
+                (i == 0 || entries[i - 1].key < entries[i].key);
+        }
+
+        if (!valid)
+        {
+            m_file.Close();
+            return;
+        }
+
+        m_entries = entries;
+        m_numEntries = size_t(header->numEntries);
+        m_entryStates = std::make_unique<std::atomic<uint8_t>[]>(m_numEntries);
+    }
+
+    static uint64_t GetKey(const char* identifier)
+    {
+        uint64_t hash = HashFNV1a(identifier, strlen(identifier));
+        uint32_t parameters[3] = { PDFTableFileHeader::c_version, uint32_t(c_PDFSamples), uint32_t(c_CDFSamples) };
+        return HashFNV1a(parameters, sizeof(parameters), hash);
+    }
+
+    // Returns false if the table isn't in the file, or hasn't been built yet
+    bool Find(const char* identifier, View& view) const
+    {
+        uint64_t key = GetKey(identifier);
+
+        const PDFTableFileEntry* end = m_entries + m_numEntries;
+        const PDFTableFileEntry* it = std::lower_bound(m_entries, end, key, [](const PDFTableFileEntry& entry, uint64_t key) { return entry.key < key; });
+        if (it != end && it->key == key && IsEntryValid(size_t(it - m_entries)))
+        {
+            view = GetFileView(*it);
+            return true;
+        }
+
+        std::lock_guard<std::mutex> lock(m_builtMutex);
+        auto builtIt = m_built.find(key);
+        if (builtIt == m_built.end())
+            return false;
+        view = builtIt->second->GetView();
+        return true;
+    }
+
+    // Returns the table from the file if it is there, otherwise builds it from the density.
+    // Can be called from multiple threads.
+    template <typename TPDFFn>
+    View Get(const char* identifier, const TPDFFn& pdf)
+    {
+        View ret;
+        if (Find(identifier, ret))
+            return ret;
+
+        std::unique_ptr<BuiltTable> table = std::make_unique<BuiltTable>();
+        PDFNumericT<TPDFFn, TPDFSamples, TCDFSamples> built(pdf);
+        std::copy(built.m_CDFTable.begin(), built.m_CDFTable.end(), table->m_CDFTable);
+        std::copy(built.m_ICDFGuide.begin(), built.m_ICDFGuide.end(), table->m_ICDFGuide);
+
+        // If another thread built the same table first, use that one, so all views of a table are the same
+        std::lock_guard<std::mutex> lock(m_builtMutex);
+        auto insert = m_built.emplace(GetKey(identifier), std::move(table));
+        return insert.first->second->GetView();
+    }
+
+    // The number of tables that weren't in the file, and had to be built
+    size_t NumBuilt() const
+    {
+        std::lock_guard<std::mutex> lock(m_builtMutex);
+        return m_built.size();
+    }
+
+    // Writes every table, from the file and built, to a new file. It is written to a temporary file which then
+    // replaces fileName with RenameReplacing, so readers never see a partial file, and if anything fails the old
+    // file is left as it was. On Windows, a file can't be replaced while it is mapped, so write to a different file
+    // than this cache has open.
+    bool Write(const char* fileName) const
+    {
+        // (key, table data) of every table, sorted by key. Tables in the file that don't match their checksum
+        // were rebuilt, if they were used.
+        std::vector<std::pair<uint64_t, View>> tables;
+        for (size_t i = 0; i < m_numEntries; ++i)
+        {
+            if (IsEntryValid(i))
+                tables.push_back({ m_entries[i].key, GetFileView(m_entries[i]) });
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_builtMutex);
+            for (const auto& built : m_built)
+                tables.push_back({ built.first, built.second->GetView() });
+        }
+        std::sort(tables.begin(), tables.end(), [](const auto& A, const auto& B) { return A.first < B.first; });
+
+        PDFTableFileHeader header = {};
+        memcpy(header.magic, c_magic, sizeof(header.magic));
+        header.version = PDFTableFileHeader::c_version;
+        header.PDFSamples = uint32_t(c_PDFSamples);
+        header.CDFSamples = uint32_t(c_CDFSamples);
+        header.ICDFGuideSize = uint32_t(c_ICDFGuideSize);
+        header.numEntries = tables.size();
+
+        size_t firstTableOffset = sizeof(PDFTableFileHeader) + tables.size() * sizeof(PDFTableFileEntry);
+        firstTableOffset = (firstTableOffset + c_tableAlignment - 1) / c_tableAlignment * c_tableAlignment;
+
+        std::vector<unsigned char> tableData(c_tableSize, 0);
+        std::vector<PDFTableFileEntry> entries(tables.size());
+        for (size_t i = 0; i < tables.size(); ++i)
+        {
+            GetTableData(tables[i].second, tableData.data());
+            entries[i] = { tables[i].first, uint64_t(firstTableOffset + i * c_tableSize), HashFNV1a(tableData.data(), c_tableSize) };
+        }
+
+        std::string tempFileName = std::string(fileName) + ".tmp";
+        FILE* file = nullptr;
+        fopen_s(&file, tempFileName.c_str(), "wb");
+        if (!file)
+            return false;
+
+        std::vector<unsigned char> padding(firstTableOffset - sizeof(PDFTableFileHeader) - entries.size() * sizeof(PDFTableFileEntry), 0);
+        bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+        success = success && fwrite(entries.data(), sizeof(PDFTableFileEntry), entries.size(), file) == entries.size();
+        success = success && fwrite(padding.data(), 1, padding.size(), file) == padding.size();
+
+        for (size_t i = 0; i < tables.size() && success; ++i)
+        {
+            GetTableData(tables[i].second, tableData.data());
+            success = fwrite(tableData.data(), 1, tableData.size(), file) == tableData.size();
+        }
+
+        success = (fclose(file) == 0) && success;
+        if (!success)
+        {
+            remove(tempFileName.c_str());
+            return false;
+        }
+
+        if (!RenameReplacing(tempFileName.c_str(), fileName))
+        {
+            remove(tempFileName.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr char c_magic[8] = { 'O', 'T', '1', 'D', 'T', 'B', 'L', 0 };
+
+    struct BuiltTable
+    {
+        View GetView() const
+        {
+            return { m_CDFTable, m_ICDFGuide };
+        }
+
+        float m_CDFTable[c_CDFSamples];
+        int m_ICDFGuide[c_ICDFGuideSize];
+    };
+
+    View GetFileView(const PDFTableFileEntry& entry) const
+    {
+        const unsigned char* table = m_file.Data() + entry.offset;
+        return { (const float*)table, (const int*)(table + sizeof(float) * c_CDFSamples) };
+    }
+
+    // The c_tableSize bytes of a table, as it is stored in the file. The padding at the end is left alone.
+    static void GetTableData(const View& view, unsigned char* data)
+    {
+        memcpy(data, view.m_CDFTable, sizeof(float) * c_CDFSamples);
+        memcpy(data + sizeof(float) * c_CDFSamples, view.m_ICDFGuide, sizeof(int) * c_ICDFGuideSize);
+    }
+
+    // Checks the checksum of a table in the file the first time it is asked for. If two threads check the same
+    // table at once, they both get the same answer, so there is no lock.
+    bool IsEntryValid(size_t index) const
+    {
+        uint8_t state = m_entryStates[index].load(std::memory_order_acquire);
+        if (state == c_entryUnchecked)
+        {
+            const PDFTableFileEntry& entry = m_entries[index];
+            state = (HashFNV1a(m_file.Data() + entry.offset, c_tableSize) == entry.checksum) ? c_entryValid : c_entryInvalid;
+            m_entryStates[index].store(state, std::memory_order_release);
+        }
+        return state == c_entryValid;
+    }
+
+    static const uint8_t c_entryUnchecked = 0;
+    static const uint8_t c_entryValid = 1;
+    static const uint8_t c_entryInvalid = 2;
+
+    MappedFile m_file;
+    const PDFTableFileEntry* m_entries = nullptr;
+    size_t m_numEntries = 0;
+    std::unique_ptr<std::atomic<uint8_t>[]> m_entryStates;  // c_entry* of each entry
+
+    // Tables that weren't in the file. They are heap allocated so views of them stay valid as more are added.
+    mutable std::mutex m_builtMutex;
+    std::unordered_map<uint64_t, std::unique_ptr<BuiltTable>> m_built;
+};
+
+typedef PDFTableCacheT<> PDFTableCache;
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "parallel.h"
+
+// The 1D optimal transport map from pdf1 to pdf2 is T(x) = ICDF2(CDF1(x)): a value at some quantile of pdf1
+// goes to the same quantile of pdf2. Moving each value only part of the way there, Lerp(x, T(x), t),
+// gives samples of the displacement interpolation at time t, which is what InterpolatePDFs_ICDF plots.
+//
+// The values are split into fixed size chunks which are spread across the threads, and each chunk is
+// mapped in small batches using the batched CDF and ICDF functions, so the temporary values stay in the cache.
+// out may be the same array as x, to remap the values in place.
+template <typename PDF1, typename PDF2>
+void TransportMap(const PDF1& pdf1, const PDF2& pdf2, const float* x, float* out, size_t count, float t = 1.0f)
+{
+    static const size_t c_chunkSize = 65536;
+    static const size_t c_batchSize = 1024;
+
+    size_t numChunks = (count + c_chunkSize - 1) / c_chunkSize;
+    ParallelFor(int(numChunks),
+        [&](int chunkIndex)
+        {
+            size_t begin = size_t(chunkIndex) * c_chunkSize;
+            size_t end = std::min(begin + c_chunkSize, count);
+
+            float u[c_batchSize];
+            float mapped[c_batchSize];
+            for (size_t batchBegin = begin; batchBegin < end; batchBegin += c_batchSize)
+            {
+                size_t batchSize = std::min(c_batchSize, end - batchBegin);
+                pdf1.CDF(&x[batchBegin], u, batchSize);
+                pdf2.ICDF(u, mapped, batchSize);
+
+                if (t == 1.0f)
+                {
+                    std::copy(mapped, mapped + batchSize, &out[batchBegin]);
+                }
+                else
+                {
+                    for (size_t i = 0; i < batchSize; ++i)
+                        out[batchBegin + i] = Lerp(x[batchBegin + i], mapped[i], t);
+                }
+            }
+        }
+    );
+}
+
+template <typename PDF1, typename PDF2>
+void TransportMap(const PDF1& pdf1, const PDF2& pdf2, std::vector<float>& values, float t = 1.0f)
+{
+    TransportMap(pdf1, pdf2, values.data(), values.data(), values.size(), t);
+}
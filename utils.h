@@ -1,34 +1,74 @@
 #pragma once
 
+#include <stdio.h>
+#include <cstdarg>
+#include <random>
+
 #include "pcg/pcg_basic.h"
 
-inline pcg32_random_t GetRNG()
+// fopen_s and sprintf_s only come with Microsoft's compiler. These do the same for other compilers.
+#if !defined(_MSC_VER)
+inline int fopen_s(FILE** file, const char* fileName, const char* mode)
+{
+    *file = fopen(fileName, mode);
+    return *file ? 0 : 1;
+}
+
+template <size_t SIZE>
+inline int sprintf_s(char (&buffer)[SIZE], const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int ret = vsnprintf(buffer, SIZE, format, args);
+    va_end(args);
+    return ret;
+}
+#endif
+
+inline uint64_t GetRNGSeed()
 {
-    pcg32_random_t rng;
 #if DETERMINISTIC()
-    pcg32_srandom_r(&rng, 0x1337FEED, 0);
+    return 0x1337FEED;
 #else
     std::random_device device;
     std::mt19937 generator(device());
     std::uniform_int_distribution<uint32_t> dist;
-    pcg32_srandom_r(&rng, dist(generator), 0);
+    return dist(generator);
 #endif
+}
+
+// Different stream values give independent sequences for the same seed
+inline pcg32_random_t GetRNG(uint64_t seed, uint64_t stream)
+{
+    pcg32_random_t rng;
+    pcg32_srandom_r(&rng, seed, stream);
     return rng;
 }
 
+inline pcg32_random_t GetRNG()
+{
+    return GetRNG(GetRNGSeed(), 0);
+}
+
 inline float RandomFloat01(pcg32_random_t& rng)
 {
     return float(pcg32_random_r(&rng)) / 4294967295.0f;
 }
 
+// 32 random bits to a float in [0,1), keeping the top 24 bits so the result can't round up to 1
+inline float BitsToFloat01(uint32_t x)
+{
+    return float(x >> 8) * (1.0f / 16777216.0f);
+}
+
 template <typename T>
-inline T Lerp(T A, T B, T t)
+constexpr T Lerp(T A, T B, T t)
 {
     return A * (T(1) - t) + B * t;
 }
 
 template <typename T>
-T Clamp(T x, T themin, T themax)
+constexpr T Clamp(T x, T themin, T themax)
 {
     if (x <= themin)
         return themin;
@@ -36,3 +76,38 @@ T Clamp(T x, T themin, T themax)
         return themax;
     return x;
 }
+
+// Compensated summation, so that adding millions of small values doesn't lose precision
+struct KahanSum
+{
+    void Add(double x)
+    {
+        double y = x - m_compensation;
+        double t = m_sum + y;
+        m_compensation = (t - m_sum) - y;
+        m_sum = t;
+    }
+
+    double Get() const
+    {
+        return m_sum;
+    }
+
+    double m_sum = 0.0;
+    double m_compensation = 0.0;
+};
+
+// Sums by recursively splitting the list in half, which keeps the rounding error growth at O(log n)
+inline double PairwiseSum(const double* values, size_t count)
+{
+    if (count <= 8)
+    {
+        double ret = 0.0;
+        for (size_t i = 0; i < count; ++i)
+            ret += values[i];
+        return ret;
+    }
+
+    size_t half = count / 2;
+    return PairwiseSum(values, half) + PairwiseSum(values + half, count - half);
+}
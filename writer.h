@@ -0,0 +1,334 @@
+#pragma once
+
+#include <stdio.h>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include "utils.h"
+
+// Writes tables of float columns to files, on a background thread so the computation can go on while the file is written.
+//
+// Two formats:
+//   CSV: the same text that fprintf("\"%f\",") per cell gives, but formatted by FormatFloatFixed6 into a large
+//   buffer that is written with a few big fwrite calls.
+//   Binary: columnar, for other tools to load directly. In the byte order of the machine that wrote it:
+//     OutputBinaryHeader
+//     for each column: uint32_t name length, then the name, not null terminated
+//     padding with zeros to a 64 byte boundary
+//     for each column: numRows floats
+// The format is picked from the file name: ".bin" files are binary, everything else is CSV.
+
+enum class OutputFormat
+{
+    CSV,
+    Binary
+};
+
+struct OutputBinaryHeader
+{
+    static const uint32_t c_version = 1;
+
+    char magic[8];      // "OT1DCOL"
+    uint32_t version;
+    uint32_t numColumns;
+    uint64_t numRows;
+};
+
+// Named columns that all have the same number of rows
+struct OutputTable
+{
+    void AddColumn(const std::string& name, std::vector<float>&& values)
+    {
+        m_columnNames.push_back(name);
+        m_columns.push_back(std::move(values));
+    }
+
+    void AddColumn(const std::string& name, const std::vector<float>& values)
+    {
+        AddColumn(name, std::vector<float>(values));
+    }
+
+    size_t NumRows() const
+    {
+        size_t ret = m_columns.empty() ? 0 : m_columns[0].size();
+        for (const std::vector<float>& column : m_columns)
+            ret = std::min(ret, column.size());
+        return ret;
+    }
+
+    std::vector<std::string> m_columnNames;
+    std::vector<std::vector<float>> m_columns;
+};
+
+inline OutputFormat GetOutputFormat(const char* fileName)
+{
+    size_t length = strlen(fileName);
+    return (length >= 4 && strcmp(fileName + length - 4, ".bin") == 0) ? OutputFormat::Binary : OutputFormat::CSV;
+}
+
+// Writes value the way printf("%f") does, which is 6 digits after the decimal point, rounded to nearest even.
+// Returns the number of characters written, which is at most 64.
+//
+// A float has a 24 bit significand and 10^6 = 2^6 * 15625 needs 14 bits, so value * 10^6 is exact in a double,
+// and rounding it to an integer gives the same digits printf does, without printf's arbitrary precision path.
+// Values too big for that, infinities and NaNs are left to snprintf.
+inline int FormatFloatFixed6(float value, char* out)
+{
+    double scaled = double(value) * 1000000.0;
+    if (!(std::abs(scaled) < 9.0e18))
+        return snprintf(out, 64, "%f", value);
+
+    int length = 0;
+    if (std::signbit(value))
+        out[length++] = '-';
+
+    uint64_t fixed = uint64_t(std::nearbyint(std::abs(scaled)));
+    uint64_t integer = fixed / 1000000;
+    uint32_t fraction = uint32_t(fixed % 1000000);
+
+    // The integer part, backwards then reversed
+    int integerBegin = length;
+    do
+    {
+        out[length++] = char('0' + integer % 10);
+        integer /= 10;
+    } while (integer > 0);
+    std::reverse(out + integerBegin, out + length);
+
+    out[length++] = '.';
+    for (int digit = 5; digit >= 0; --digit)
+    {
+        out[length + digit] = char('0' + fraction % 10);
+        fraction /= 10;
+    }
+    return length + 6;
+}
+
+// Writes data to a file in large blocks
+struct BufferedFileWriter
+{
+    static const size_t c_bufferSize = 1 << 20;
+
+    BufferedFileWriter(const char* fileName, const char* mode)
+    {
+        fopen_s(&m_file, fileName, mode);
+        m_buffer.reserve(c_bufferSize);
+    }
+
+    ~BufferedFileWriter()
+    {
+        Close();
+    }
+
+    bool IsOpen() const
+    {
+        return m_file != nullptr;
+    }
+
+    void Write(const void* data, size_t size)
+    {
+        if (m_buffer.size() + size > c_bufferSize)
+            FlushBuffer();
+
+        if (size > c_bufferSize)
+            m_success = m_success && fwrite(data, 1, size, m_file) == size;
+        else
+            m_buffer.insert(m_buffer.end(), (const char*)data, (const char*)data + size);
+    }
+
+    void Write(const char* text)
+    {
+        Write(text, strlen(text));
+    }
+
+    // Returns false if anything failed to write
+    bool Close()
+    {
+        if (!m_file)
+            return false;
+
+        FlushBuffer();
+        m_success = (fclose(m_file) == 0) && m_success;
+        m_file = nullptr;
+        return m_success;
+    }
+
+private:
+    void FlushBuffer()
+    {
+        if (!m_buffer.empty())
+            m_success = m_success && fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) == m_buffer.size();
+        m_buffer.clear();
+    }
+
+    FILE* m_file = nullptr;
+    std::vector<char> m_buffer;
+    bool m_success = true;
+};
+
+// Same as a row of fprintf(file, "\"%s\",") then "\n" for the names, then fprintf(file, "\"%f\",") per cell
+inline bool WriteTableCSV(const char* fileName, const OutputTable& table)
+{
+    BufferedFileWriter file(fileName, "wt");
+    if (!file.IsOpen())
+        return false;
+
+    for (const std::string& name : table.m_columnNames)
+    {
+        file.Write("\"");
+        file.Write(name.c_str());
+        file.Write("\",");
+    }
+    file.Write("\n");
+
+    size_t numRows = table.NumRows();
+    std::vector<char> line;
+    char cell[64];
+    for (size_t row = 0; row < numRows; ++row)
+    {
+        line.clear();
+        for (const std::vector<float>& column : table.m_columns)
+        {
+            line.push_back('"');
+            int length = FormatFloatFixed6(column[row], cell);
+            line.insert(line.end(), cell, cell + length);
+            line.push_back('"');
+            line.push_back(',');
+        }
+        line.push_back('\n');
+        file.Write(line.data(), line.size());
+    }
+    return file.Close();
+}
+
+inline bool WriteTableBinary(const char* fileName, const OutputTable& table)
+{
+    BufferedFileWriter file(fileName, "wb");
+    if (!file.IsOpen())
+        return false;
+
+    OutputBinaryHeader header = {};
+    memcpy(header.magic, "OT1DCOL", 8);
+    header.version = OutputBinaryHeader::c_version;
+    header.numColumns = uint32_t(table.m_columns.size());
+    header.numRows = table.NumRows();
+    file.Write(&header, sizeof(header));
+
+    size_t offset = sizeof(header);
+    for (const std::string& name : table.m_columnNames)
+    {
+        uint32_t length = uint32_t(name.size());
+        file.Write(&length, sizeof(length));
+        file.Write(name.data(), name.size());
+        offset += sizeof(length) + name.size();
+    }
+
+    static const char c_padding[64] = {};
+    file.Write(c_padding, (64 - offset % 64) % 64);
+
+    for (const std::vector<float>& column : table.m_columns)
+        file.Write(column.data(), size_t(header.numRows) * sizeof(float));
+    return file.Close();
+}
+
+inline bool WriteTable(const char* fileName, const OutputTable& table, OutputFormat format)
+{
+    return (format == OutputFormat::Binary) ? WriteTableBinary(fileName, table) : WriteTableCSV(fileName, table);
+}
+
+// A thread that writes tables in the order they were given to it.
+// Write() takes the table and returns right away. Flush() waits until everything given so far is written.
+// Everything is flushed when the program exits too.
+struct OutputWriter
+{
+    static OutputWriter& Get()
+    {
+        static OutputWriter writer;
+        return writer;
+    }
+
+    OutputWriter()
+    {
+        m_thread = std::thread([this]() { WriterLoop(); });
+    }
+
+    ~OutputWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_wake.notify_all();
+        m_thread.join();
+    }
+
+    void Write(const char* fileName, OutputTable&& table)
+    {
+        Write(fileName, std::move(table), GetOutputFormat(fileName));
+    }
+
+    void Write(const char* fileName, OutputTable&& table, OutputFormat format)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back({ fileName, std::move(table), format });
+        }
+        m_wake.notify_all();
+    }
+
+    void Flush()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this]() { return m_jobs.empty() && !m_busy; });
+    }
+
+private:
+    struct Job
+    {
+        std::string fileName;
+        OutputTable table;
+        OutputFormat format;
+    };
+
+    void WriterLoop()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_wake.wait(lock, [this]() { return m_quit || !m_jobs.empty(); });
+
+            // Finish writing everything before quitting
+            if (m_jobs.empty())
+                return;
+
+            Job job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            m_busy = true;
+            lock.unlock();
+
+            if (!WriteTable(job.fileName.c_str(), job.table, job.format))
+                printf("Could not write %s\n", job.fileName.c_str());
+
+            lock.lock();
+            m_busy = false;
+            if (m_jobs.empty())
+                m_done.notify_all();
+        }
+    }
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    std::deque<Job> m_jobs;
+    bool m_busy = false;
+    bool m_quit = false;
+};